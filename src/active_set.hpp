@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Per-species lists of the cells that currently hold a live entity, so a tick
+// costs O(live entities) instead of O(cells). Each occupied cell remembers which
+// list it is in and at which position, which makes insertion and removal O(1)
+// (removal swaps the last element into the freed slot, so lists are unordered).
+struct active_sets_t
+{
+    static const uint32_t NUM_LISTS = 4;
+
+    std::vector<uint64_t> lists[NUM_LISTS]; // indexed by entity type, lists[0] unused
+    std::vector<uint8_t> listed;            // list each cell is in, 0 when none
+    std::vector<uint32_t> slots;            // position of each cell inside its list
+
+    void reset(uint64_t num_cells)
+    {
+        for (std::vector<uint64_t> &list : lists)
+        {
+            list.clear();
+        }
+        listed.assign(num_cells, 0);
+        slots.assign(num_cells, 0);
+    }
+
+    const std::vector<uint64_t> &of(uint8_t type) const
+    {
+        return lists[type];
+    }
+
+    uint64_t size() const
+    {
+        return lists[1].size() + lists[2].size() + lists[3].size();
+    }
+
+    // Puts the list of the type back in increasing cell index order, which is
+    // the storage order of the cells, and renumbers the slots
+    void sort(uint8_t type)
+    {
+        std::vector<uint64_t> &list = lists[type];
+        std::sort(list.begin(), list.end());
+        for (uint32_t slot = 0; slot < list.size(); slot++)
+        {
+            slots[list[slot]] = slot;
+        }
+    }
+
+    // Moves the cell to the list of the entity type it now holds (0 removes it)
+    void sync(uint64_t idx, uint8_t type)
+    {
+        uint8_t current = listed[idx];
+        if (current == type)
+            return;
+        if (current != 0)
+        {
+            std::vector<uint64_t> &list = lists[current];
+            uint32_t slot = slots[idx];
+            uint64_t last = list.back();
+            list[slot] = last;
+            slots[last] = slot;
+            list.pop_back();
+        }
+        if (type != 0)
+        {
+            slots[idx] = (uint32_t)lists[type].size();
+            lists[type].push_back(idx);
+        }
+        listed[idx] = type;
+    }
+};
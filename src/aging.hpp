@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Aging and death test of count entities of one species, gathered in
+// contiguous arrays: entity k dies when ages[k] == maximum_age or
+// energies[k] <= 0 (dies[k] = 1), and otherwise grows one year older
+// (dies[k] = 0). Eight entities per step with AVX2, otherwise in a plain loop
+// the compiler can vectorize.
+inline void age_entities(int32_t *ages, const int32_t *energies, uint8_t *dies, uint32_t count, int32_t maximum_age)
+{
+    uint32_t k = 0;
+#ifdef __AVX2__
+    const __m256i maximum = _mm256_set1_epi32(maximum_age);
+    const __m256i one = _mm256_set1_epi32(1);
+    for (; k + 8 <= count; k += 8)
+    {
+        __m256i age = _mm256_loadu_si256((const __m256i *)(ages + k));
+        __m256i energy = _mm256_loadu_si256((const __m256i *)(energies + k));
+        // energy <= 0 is 1 > energy
+        __m256i dying = _mm256_or_si256(_mm256_cmpeq_epi32(age, maximum), _mm256_cmpgt_epi32(one, energy));
+        age = _mm256_add_epi32(age, _mm256_andnot_si256(dying, one));
+        _mm256_storeu_si256((__m256i *)(ages + k), age);
+        uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(dying));
+        for (uint32_t b = 0; b < 8; b++)
+        {
+            dies[k + b] = (mask >> b) & 1;
+        }
+    }
+#endif
+    for (; k < count; k++)
+    {
+        uint8_t dying = (ages[k] == maximum_age) | (energies[k] <= 0);
+        ages[k] += 1 - dying;
+        dies[k] = dying;
+    }
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// One bit per cell. Rows are padded to whole 64-bit words, so a row word holds
+// 64 consecutive columns and the neighbors of all of them are reached by
+// shifting whole words (see world_t::neighbor_words()). Bits are flipped with
+// atomic word updates, so workers changing different cells of the same word
+// never lose each other's changes.
+//
+// The board carries a one word thick halo: rows -1 and num_rows and words -1
+// and words_per_row exist, so the neighbor words of any row word are read
+// without bounds checks. In a closed board the halo stays zero. A toroidal
+// board mirrors every cell of the grid border into the halo cell on the
+// opposite side (row -1 holds row num_rows - 1, column -1 holds column
+// num_cols - 1, and so on), so shifted words see the wrapped neighbors.
+struct bitboard_t
+{
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+    uint32_t num_rows = 0;
+    uint32_t num_cols = 0;
+    uint32_t words_per_row = 0;
+    bool toroidal = false;
+
+    void reset(uint32_t rows, uint32_t cols, bool wraps = false)
+    {
+        num_rows = rows;
+        num_cols = cols;
+        words_per_row = (cols + 63) / 64;
+        toroidal = wraps;
+        uint64_t num_words = (uint64_t)(rows + 2) * stride();
+        words.reset(new std::atomic<uint64_t>[num_words]);
+        for (uint64_t w = 0; w < num_words; w++)
+        {
+            words[w].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void set(uint32_t i, uint32_t j)
+    {
+        update(i, j, true);
+    }
+
+    void unset(uint32_t i, uint32_t j)
+    {
+        update(i, j, false);
+    }
+
+    // Sets every cell of the grid, halo mirrors included, a whole word at a
+    // time; only the mirrors of the first and last columns go bit by bit
+    void fill()
+    {
+        uint64_t last_word = num_cols % 64 == 0 ? ~0ull : (1ull << (num_cols % 64)) - 1;
+        // a toroidal board also mirrors the first and last rows in the halo rows
+        int64_t first_row = toroidal ? -1 : 0;
+        int64_t end_row = toroidal ? (int64_t)num_rows + 1 : num_rows;
+        for (int64_t i = first_row; i < end_row; i++)
+        {
+            for (uint32_t w = 0; w + 1 < words_per_row; w++)
+            {
+                at(i, w).store(~0ull, std::memory_order_relaxed);
+            }
+            at(i, words_per_row - 1).store(last_word, std::memory_order_relaxed);
+        }
+        if (!toroidal)
+            return;
+        for (uint32_t i = 0; i < num_rows; i++)
+        {
+            update_bit(i, -1, true);
+            update_bit(i, num_cols, true);
+        }
+    }
+
+    // Sets the bits of `bits` in the row word (i, w)
+    void merge(uint32_t i, uint32_t w, uint64_t bits)
+    {
+        if (bits != 0)
+            at(i, w).fetch_or(bits, std::memory_order_relaxed);
+    }
+
+    bool test(uint32_t i, uint32_t j) const
+    {
+        return (word(i, j / 64) >> (j % 64)) & 1;
+    }
+
+    // Columns 64w .. 64w + 63 of row i; i may be -1 or num_rows and w may be
+    // -1 or words_per_row to read the halo
+    uint64_t word(int64_t i, int64_t w) const
+    {
+        return at(i, w).load(std::memory_order_relaxed);
+    }
+
+    void store(uint32_t i, uint32_t w, uint64_t value)
+    {
+        at(i, w).store(value, std::memory_order_relaxed);
+    }
+
+private:
+    uint64_t stride() const
+    {
+        return (uint64_t)words_per_row + 2;
+    }
+
+    std::atomic<uint64_t> &at(int64_t i, int64_t w) const
+    {
+        return words[(uint64_t)(i + 1) * stride() + (uint64_t)(w + 1)];
+    }
+
+    // Bit of column j (-1 .. num_cols) of row i (-1 .. num_rows)
+    void update_bit(int64_t i, int64_t j, bool value)
+    {
+        int64_t w = (j + 64) / 64 - 1;
+        uint64_t bit = 1ull << ((j + 64) % 64);
+        if (value)
+            at(i, w).fetch_or(bit, std::memory_order_relaxed);
+        else
+            at(i, w).fetch_and(~bit, std::memory_order_relaxed);
+    }
+
+    void update(uint32_t i, uint32_t j, bool value)
+    {
+        update_bit(i, j, value);
+        if (!toroidal)
+            return;
+        if (i == 0)
+            update_bit(num_rows, j, value);
+        if (i == num_rows - 1)
+            update_bit(-1, j, value);
+        if (j == 0)
+            update_bit(i, num_cols, value);
+        if (j == num_cols - 1)
+            update_bit(i, -1, value);
+    }
+};
+
+// Directions of the von Neumann neighbors, in the order every neighbor scan
+// visits them. Bit d of a neighbor mask stands for direction d.
+enum neighbor_direction_t : uint32_t
+{
+    NEIGHBOR_DOWN,
+    NEIGHBOR_UP,
+    NEIGHBOR_RIGHT,
+    NEIGHBOR_LEFT,
+    NUM_NEIGHBORS
+};
+
+// Row and column steps to the neighbor in each direction
+inline constexpr int32_t NEIGHBOR_ROW_STEPS[NUM_NEIGHBORS] = {1, -1, 0, 0};
+inline constexpr int32_t NEIGHBOR_COL_STEPS[NUM_NEIGHBORS] = {0, 0, 1, -1};
+
+// For the 64 cells of a row word, bit b of dir[d] tells whether the neighbor of
+// cell b in direction d holds the queried type
+struct neighbor_words_t
+{
+    uint64_t dir[NUM_NEIGHBORS];
+
+    // 4-bit neighbor mask of cell b of the word
+    uint32_t mask(uint32_t b) const
+    {
+        return (uint32_t)((dir[NEIGHBOR_DOWN] >> b) & 1) |
+               (uint32_t)((dir[NEIGHBOR_UP] >> b) & 1) << NEIGHBOR_UP |
+               (uint32_t)((dir[NEIGHBOR_RIGHT] >> b) & 1) << NEIGHBOR_RIGHT |
+               (uint32_t)((dir[NEIGHBOR_LEFT] >> b) & 1) << NEIGHBOR_LEFT;
+    }
+};
+
+// Lookup tables to pick a neighbor out of a 4-bit neighbor mask without
+// building a candidate list: count[mask] is the number of neighbors in the mask
+// and direction[mask][r] the direction of the r-th one, so a uniform draw r in
+// [0, count[mask]) picks a neighbor with two table reads.
+struct neighbor_choices_t
+{
+    uint8_t count[1 << NUM_NEIGHBORS];
+    uint8_t direction[1 << NUM_NEIGHBORS][NUM_NEIGHBORS];
+
+    constexpr neighbor_choices_t() : count(), direction()
+    {
+        for (uint32_t mask = 0; mask < (1u << NUM_NEIGHBORS); mask++)
+        {
+            for (uint32_t d = 0; d < NUM_NEIGHBORS; d++)
+            {
+                if ((mask >> d) & 1)
+                    direction[mask][count[mask]++] = (uint8_t)d;
+            }
+        }
+    }
+};
+
+inline constexpr neighbor_choices_t NEIGHBOR_CHOICES{};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+
+// Maps the cells of a rows x cols grid to storage indices and back.
+//
+// The default layout is row-major: index(i, j) = i * cols + j. Building with
+// ECOSIM_BLOCKED_LAYOUT stores the grid as BLOCK_SIZE x BLOCK_SIZE blocks laid
+// out row-major, with the cells of each block in Morton (Z) order, so the
+// vertical neighbors of a cell are usually a few dozen cells away instead of a
+// whole row, and a block's types fit in a few cache lines. The grid is padded
+// to whole blocks; the padding cells are never occupied.
+//
+// Storage order is also the order the schedules visit the entities in, so
+// seeded runs of the two layouts differ. Random streams are keyed by the
+// row-major position and do not depend on the layout.
+struct cell_layout_t
+{
+    uint32_t num_rows = 0;
+    uint32_t num_cols = 0;
+#ifdef ECOSIM_BLOCKED_LAYOUT
+    static constexpr bool ROW_MAJOR = false;
+    static const uint32_t BLOCK_BITS = 4;
+    static const uint32_t BLOCK_SIZE = 1u << BLOCK_BITS;
+    uint32_t blocks_per_row = 0;
+    uint32_t blocks_per_col = 0;
+
+    void reset(uint32_t rows, uint32_t cols)
+    {
+        num_rows = rows;
+        num_cols = cols;
+        blocks_per_row = (cols + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        blocks_per_col = (rows + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+
+    uint64_t num_cells() const
+    {
+        return (uint64_t)blocks_per_row * blocks_per_col * BLOCK_SIZE * BLOCK_SIZE;
+    }
+
+    uint64_t index(uint32_t i, uint32_t j) const
+    {
+        uint64_t block = (uint64_t)(i >> BLOCK_BITS) * blocks_per_row + (j >> BLOCK_BITS);
+        uint32_t morton = spread(i & (BLOCK_SIZE - 1)) << 1 | spread(j & (BLOCK_SIZE - 1));
+        return (block << (2 * BLOCK_BITS)) | morton;
+    }
+
+    uint32_t row(uint64_t idx) const
+    {
+        uint64_t block = idx >> (2 * BLOCK_BITS);
+        return (uint32_t)(block / blocks_per_row) << BLOCK_BITS | compact((uint32_t)idx >> 1);
+    }
+
+    uint32_t col(uint64_t idx) const
+    {
+        uint64_t block = idx >> (2 * BLOCK_BITS);
+        return (uint32_t)(block % blocks_per_row) << BLOCK_BITS | compact((uint32_t)idx);
+    }
+
+private:
+    // 4 bits to the even bits of a byte, and back
+    static uint32_t spread(uint32_t x)
+    {
+        x = (x | (x << 2)) & 0x33;
+        return (x | (x << 1)) & 0x55;
+    }
+
+    static uint32_t compact(uint32_t x)
+    {
+        x &= 0x55;
+        x = (x | (x >> 1)) & 0x33;
+        return (x | (x >> 2)) & 0x0F;
+    }
+#else
+    static constexpr bool ROW_MAJOR = true;
+
+    void reset(uint32_t rows, uint32_t cols)
+    {
+        num_rows = rows;
+        num_cols = cols;
+    }
+
+    uint64_t num_cells() const
+    {
+        return (uint64_t)num_rows * num_cols;
+    }
+
+    uint64_t index(uint32_t i, uint32_t j) const
+    {
+        return (uint64_t)i * num_cols + j;
+    }
+
+    uint32_t row(uint64_t idx) const
+    {
+        return (uint32_t)(idx / num_cols);
+    }
+
+    uint32_t col(uint64_t idx) const
+    {
+        return (uint32_t)(idx % num_cols);
+    }
+#endif
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// How the locked schedule guards the cells
+//  - mutex_locking: one std::mutex per cell (40 bytes each)
+//  - spin_locking: one byte per cell, taken with an atomic exchange and
+//    spun on while held
+//  - striped_locking: a fixed table of NUM_STRIPES spinlocks, each on its own
+//    cache line, shared by the cells that hash to it
+enum locking_t
+{
+    mutex_locking,
+    spin_locking,
+    striped_locking
+};
+
+// Lock layer of the locked schedule. Cells are not locked directly: a cell is
+// guarded by the lock lock_id(idx), and several cells may share a lock when
+// striped. Callers that hold several locks at once take them in increasing
+// id order and each id once, which rules out deadlocks.
+struct cell_locks_t
+{
+    static const uint32_t STRIPE_BITS = 12;
+    static const uint64_t NUM_STRIPES = 1ull << STRIPE_BITS;
+
+    // a stripe per cache line, so that spinning on one does not slow the others
+    struct alignas(64) stripe_t
+    {
+        std::atomic<uint8_t> held{0};
+    };
+
+    locking_t kind = mutex_locking;
+    std::vector<std::mutex> mutexes;
+    std::unique_ptr<std::atomic<uint8_t>[]> bytes;
+    std::unique_ptr<stripe_t[]> stripes;
+
+    void reset(locking_t locking, uint64_t num_cells)
+    {
+        release();
+        kind = locking;
+        if (kind == mutex_locking)
+        {
+            // std::mutex is not copyable, so the vector is rebuilt instead of assigned
+            mutexes = std::vector<std::mutex>(num_cells);
+        }
+        else if (kind == spin_locking)
+        {
+            bytes.reset(new std::atomic<uint8_t>[num_cells]);
+            for (uint64_t idx = 0; idx < num_cells; idx++)
+            {
+                bytes[idx].store(0, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            stripes.reset(new stripe_t[NUM_STRIPES]);
+        }
+    }
+
+    void release()
+    {
+        std::vector<std::mutex>().swap(mutexes);
+        bytes.reset();
+        stripes.reset();
+    }
+
+    // Lock guarding the cell. Stripes are picked by Fibonacci hashing, so the
+    // cells of a neighborhood rarely share one.
+    uint64_t lock_id(uint64_t idx) const
+    {
+        if (kind != striped_locking)
+            return idx;
+        return (idx * 0x9E3779B97F4A7C15ull) >> (64 - STRIPE_BITS);
+    }
+
+    void lock(uint64_t id)
+    {
+        if (kind == mutex_locking)
+            mutexes[id].lock();
+        else if (kind == spin_locking)
+            spin(bytes[id]);
+        else
+            spin(stripes[id].held);
+    }
+
+    void unlock(uint64_t id)
+    {
+        if (kind == mutex_locking)
+            mutexes[id].unlock();
+        else if (kind == spin_locking)
+            bytes[id].store(0, std::memory_order_release);
+        else
+            stripes[id].held.store(0, std::memory_order_release);
+    }
+
+private:
+    // Test and test-and-set: waiters spin on a plain load, which stays in
+    // their cache until the holder releases the lock
+    static void spin(std::atomic<uint8_t> &held)
+    {
+        while (held.exchange(1, std::memory_order_acquire))
+        {
+            while (held.load(std::memory_order_relaxed))
+            {
+#if defined(__x86_64__) || defined(__i386__)
+                _mm_pause();
+#else
+                std::this_thread::yield();
+#endif
+            }
+        }
+    }
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Per-cell claims used to arbitrate conflicting intents without locks. Every
+// claimant has a rank and the lowest rank wins, whatever the order in which
+// threads post their claims, which keeps the arbitration deterministic.
+//
+// A claim word holds the epoch of the tick in its high 32 bits and the rank of
+// the best claimant in its low 32 bits, so claims from older ticks read as
+// unclaimed and nothing has to be cleared between ticks.
+struct claim_board_t
+{
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+    uint64_t num_cells = 0;
+    uint32_t epoch = 1;
+
+    void reset(uint64_t cells)
+    {
+        num_cells = cells;
+        words.reset(new std::atomic<uint64_t>[cells]);
+        clear();
+        epoch = 1;
+    }
+
+    void release()
+    {
+        words.reset();
+        num_cells = 0;
+    }
+
+    void clear()
+    {
+        for (uint64_t idx = 0; idx < num_cells; idx++)
+        {
+            words[idx].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Starts a new tick; the board is wiped only when the epoch wraps around
+    void advance()
+    {
+        epoch++;
+        if (epoch == 0)
+        {
+            clear();
+            epoch = 1;
+        }
+    }
+
+    // Posts a claim on the cell, keeping it only if it beats the current one
+    void claim(uint64_t idx, uint32_t rank)
+    {
+        uint64_t wanted = ((uint64_t)epoch << 32) | rank;
+        uint64_t current = words[idx].load(std::memory_order_relaxed);
+        while ((uint32_t)(current >> 32) != epoch || (uint32_t)current > rank)
+        {
+            if (words[idx].compare_exchange_weak(current, wanted, std::memory_order_relaxed))
+                return;
+        }
+    }
+
+    bool is_claimed(uint64_t idx) const
+    {
+        return (uint32_t)(words[idx].load(std::memory_order_relaxed) >> 32) == epoch;
+    }
+
+    bool won(uint64_t idx, uint32_t rank) const
+    {
+        uint64_t current = words[idx].load(std::memory_order_relaxed);
+        return (uint32_t)(current >> 32) == epoch && (uint32_t)current == rank;
+    }
+};
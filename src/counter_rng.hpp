@@ -0,0 +1,256 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+// A counter-based generator: the output block is a pure function of a 128-bit
+// counter and a 64-bit key, so any draw can be recomputed from its coordinates
+// and no generator state is shared between threads.
+inline void philox4x32_10(uint32_t block[4], uint32_t k0, uint32_t k1)
+{
+    static const uint32_t MULTIPLIER_0 = 0xD2511F53u;
+    static const uint32_t MULTIPLIER_1 = 0xCD9E8D57u;
+    static const uint32_t WEYL_0 = 0x9E3779B9u;
+    static const uint32_t WEYL_1 = 0xBB67AE85u;
+
+    for (int round = 0; round < 10; round++)
+    {
+        uint64_t product_0 = (uint64_t)MULTIPLIER_0 * block[0];
+        uint64_t product_1 = (uint64_t)MULTIPLIER_1 * block[2];
+        uint32_t x0 = (uint32_t)(product_1 >> 32) ^ block[1] ^ k0;
+        uint32_t x1 = (uint32_t)product_1;
+        uint32_t x2 = (uint32_t)(product_0 >> 32) ^ block[3] ^ k1;
+        uint32_t x3 = (uint32_t)product_0;
+        block[0] = x0;
+        block[1] = x1;
+        block[2] = x2;
+        block[3] = x3;
+        k0 += WEYL_0;
+        k1 += WEYL_1;
+    }
+}
+
+// Same rounds as philox4x32_10() over many counters at once, held in
+// structure-of-arrays form (word w of lane l is x[w][l]) so that consecutive
+// lanes map onto SIMD lanes: eight at a time with AVX2, otherwise in a plain
+// loop the compiler can vectorize.
+inline void philox4x32_10_lanes(uint32_t *x[4], uint32_t count, uint32_t k0, uint32_t k1)
+{
+    static const uint32_t MULTIPLIER_0 = 0xD2511F53u;
+    static const uint32_t MULTIPLIER_1 = 0xCD9E8D57u;
+    static const uint32_t WEYL_0 = 0x9E3779B9u;
+    static const uint32_t WEYL_1 = 0xBB67AE85u;
+
+    uint32_t first = 0;
+#ifdef __AVX2__
+    const __m256i multiplier_0 = _mm256_set1_epi32((int)MULTIPLIER_0);
+    const __m256i multiplier_1 = _mm256_set1_epi32((int)MULTIPLIER_1);
+    for (; first + 8 <= count; first += 8)
+    {
+        __m256i x0 = _mm256_loadu_si256((const __m256i *)(x[0] + first));
+        __m256i x1 = _mm256_loadu_si256((const __m256i *)(x[1] + first));
+        __m256i x2 = _mm256_loadu_si256((const __m256i *)(x[2] + first));
+        __m256i x3 = _mm256_loadu_si256((const __m256i *)(x[3] + first));
+        uint32_t key_0 = k0;
+        uint32_t key_1 = k1;
+        for (int round = 0; round < 10; round++)
+        {
+            // 32x32->64 products of the even lanes, then of the odd ones
+            __m256i even_0 = _mm256_mul_epu32(x0, multiplier_0);
+            __m256i odd_0 = _mm256_mul_epu32(_mm256_srli_epi64(x0, 32), multiplier_0);
+            __m256i even_1 = _mm256_mul_epu32(x2, multiplier_1);
+            __m256i odd_1 = _mm256_mul_epu32(_mm256_srli_epi64(x2, 32), multiplier_1);
+            __m256i low_0 = _mm256_blend_epi32(even_0, _mm256_slli_epi64(odd_0, 32), 0xAA);
+            __m256i high_0 = _mm256_blend_epi32(_mm256_srli_epi64(even_0, 32), odd_0, 0xAA);
+            __m256i low_1 = _mm256_blend_epi32(even_1, _mm256_slli_epi64(odd_1, 32), 0xAA);
+            __m256i high_1 = _mm256_blend_epi32(_mm256_srli_epi64(even_1, 32), odd_1, 0xAA);
+            x0 = _mm256_xor_si256(_mm256_xor_si256(high_1, x1), _mm256_set1_epi32((int)key_0));
+            x1 = low_1;
+            x2 = _mm256_xor_si256(_mm256_xor_si256(high_0, x3), _mm256_set1_epi32((int)key_1));
+            x3 = low_0;
+            key_0 += WEYL_0;
+            key_1 += WEYL_1;
+        }
+        _mm256_storeu_si256((__m256i *)(x[0] + first), x0);
+        _mm256_storeu_si256((__m256i *)(x[1] + first), x1);
+        _mm256_storeu_si256((__m256i *)(x[2] + first), x2);
+        _mm256_storeu_si256((__m256i *)(x[3] + first), x3);
+    }
+#endif
+    uint32_t key_0 = k0;
+    uint32_t key_1 = k1;
+    for (int round = 0; round < 10; round++)
+    {
+        for (uint32_t l = first; l < count; l++)
+        {
+            uint64_t product_0 = (uint64_t)MULTIPLIER_0 * x[0][l];
+            uint64_t product_1 = (uint64_t)MULTIPLIER_1 * x[2][l];
+            uint32_t x0 = (uint32_t)(product_1 >> 32) ^ x[1][l] ^ key_0;
+            uint32_t x2 = (uint32_t)(product_0 >> 32) ^ x[3][l] ^ key_1;
+            x[1][l] = (uint32_t)product_1;
+            x[3][l] = (uint32_t)product_0;
+            x[0][l] = x0;
+            x[2][l] = x2;
+        }
+        key_0 += WEYL_0;
+        key_1 += WEYL_1;
+    }
+}
+
+// Threshold on a uniform 32-bit draw that passes with the given probability;
+// 1.0 maps to 2^32, so it always passes
+constexpr uint64_t probability_threshold(double probability)
+{
+    return (uint64_t)(probability * 4294967296.0);
+}
+
+// Blocks of each stream computed ahead of time by rng_prefetch_t; eight draws
+// cover what an entity consumes in a tick, later draws fall back to scalar
+static const uint32_t PREFETCHED_BLOCKS = 2;
+static const uint32_t PREFETCHED_WORDS = PREFETCHED_BLOCKS * 4;
+
+// Sequence of random numbers identified by (seed, tick, stream). The counter
+// of draw d is {d / 4, stream, tick low, tick high} and every Philox block
+// feeds four consecutive draws, so the n-th number of a stream is the same
+// whichever thread asks for it and whatever ran before. A stream can start
+// from blocks prefetched by rng_prefetch_t and only computes the blocks past
+// them.
+struct rng_stream_t
+{
+    uint32_t key[2] = {0, 0};
+    uint32_t counter[4] = {0, 0, 0, 0};
+    uint32_t buffer[4] = {0, 0, 0, 0};
+    const uint32_t *prefetched = nullptr;
+    uint32_t num_prefetched = 0;
+    uint32_t draw = 0;
+
+    void start(uint64_t seed, uint64_t tick, uint32_t stream,
+               const uint32_t *prefetched_words = nullptr, uint32_t num_words = 0)
+    {
+        key[0] = (uint32_t)seed;
+        key[1] = (uint32_t)(seed >> 32);
+        counter[1] = stream;
+        counter[2] = (uint32_t)tick;
+        counter[3] = (uint32_t)(tick >> 32);
+        prefetched = prefetched_words;
+        num_prefetched = num_words;
+        draw = 0;
+    }
+
+    uint32_t next()
+    {
+        if (draw < num_prefetched)
+            return prefetched[draw++];
+        if ((draw & 3) == 0)
+        {
+            counter[0] = draw >> 2;
+            for (int w = 0; w < 4; w++)
+            {
+                buffer[w] = counter[w];
+            }
+            philox4x32_10(buffer, key[0], key[1]);
+        }
+        return buffer[draw++ & 3];
+    }
+
+    // Uniform integer in [0, n), n > 0, without modulo bias (Lemire's method)
+    uint32_t below(uint32_t n)
+    {
+        uint64_t product = (uint64_t)next() * n;
+        uint32_t low = (uint32_t)product;
+        if (low < n)
+        {
+            uint32_t threshold = (uint32_t)(-n) % n;
+            while (low < threshold)
+            {
+                product = (uint64_t)next() * n;
+                low = (uint32_t)product;
+            }
+        }
+        return (uint32_t)(product >> 32);
+    }
+
+    // True with the probability the threshold was built from
+    bool chance(uint64_t threshold)
+    {
+        return next() < threshold;
+    }
+};
+
+// Block of every stream reserved for stream_keys(); entities never draw that far
+static const uint32_t KEY_BLOCK = UINT32_MAX;
+
+// One random 32-bit key per stream for the tick, the first word of block
+// KEY_BLOCK of each stream, so the keys never overlap the draws of the
+// entities. Computed with philox4x32_10_lanes() in batches on the stack.
+inline void stream_keys(uint64_t seed, uint64_t tick, const uint32_t *streams, uint64_t count, uint32_t *keys)
+{
+    static const uint32_t BATCH = 256;
+    uint32_t lanes[4][BATCH];
+    for (uint64_t first = 0; first < count; first += BATCH)
+    {
+        uint32_t n = count - first < BATCH ? (uint32_t)(count - first) : BATCH;
+        for (uint32_t l = 0; l < n; l++)
+        {
+            lanes[0][l] = KEY_BLOCK;
+            lanes[1][l] = streams[first + l];
+            lanes[2][l] = (uint32_t)tick;
+            lanes[3][l] = (uint32_t)(tick >> 32);
+        }
+        uint32_t *x[4] = {lanes[0], lanes[1], lanes[2], lanes[3]};
+        philox4x32_10_lanes(x, n, (uint32_t)seed, (uint32_t)(seed >> 32));
+        for (uint32_t l = 0; l < n; l++)
+        {
+            keys[first + l] = lanes[0][l];
+        }
+    }
+}
+
+// First PREFETCHED_BLOCKS blocks of a run of streams of the same tick, computed
+// with philox4x32_10_lanes() in one pass. Each worker keeps its own and refills
+// it before running a chunk of entities.
+struct rng_prefetch_t
+{
+    std::vector<uint32_t> lanes[4];
+    std::vector<uint32_t> words; // PREFETCHED_WORDS per stream, in draw order
+
+    void fill(uint64_t seed, uint64_t tick, const uint32_t *streams, uint32_t count)
+    {
+        uint32_t num_lanes = count * PREFETCHED_BLOCKS;
+        for (std::vector<uint32_t> &lane : lanes)
+        {
+            lane.resize(num_lanes);
+        }
+        for (uint32_t k = 0; k < count; k++)
+        {
+            for (uint32_t b = 0; b < PREFETCHED_BLOCKS; b++)
+            {
+                uint32_t l = k * PREFETCHED_BLOCKS + b;
+                lanes[0][l] = b;
+                lanes[1][l] = streams[k];
+                lanes[2][l] = (uint32_t)tick;
+                lanes[3][l] = (uint32_t)(tick >> 32);
+            }
+        }
+        uint32_t *x[4] = {lanes[0].data(), lanes[1].data(), lanes[2].data(), lanes[3].data()};
+        philox4x32_10_lanes(x, num_lanes, (uint32_t)seed, (uint32_t)(seed >> 32));
+        words.resize((uint64_t)num_lanes * 4);
+        for (uint32_t l = 0; l < num_lanes; l++)
+        {
+            for (uint32_t w = 0; w < 4; w++)
+            {
+                words[l * 4 + w] = lanes[w][l];
+            }
+        }
+    }
+
+    // Prefetched draws of the k-th stream of the last fill()
+    const uint32_t *of(uint32_t k) const
+    {
+        return &words[(uint64_t)k * PREFETCHED_WORDS];
+    }
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "world.hpp"
+#include <array>
+#include <cstdint>
+
+// Grid of a size fixed at compile time, for the small worlds of interactive
+// sessions. All the state lives in std::arrays sized by the template
+// arguments, and the cells sit inside a one cell thick halo of walls, so the
+// four neighbors of any cell are at constant offsets and neighbor queries
+// never test the edges: a wall never matches the type being looked for.
+// Cells are addressed by slot, their index in the padded grid, which is the
+// cell handle the entity kernels get (see simulate_entity()).
+template <uint32_t ROWS, uint32_t COLS>
+struct fixed_grid_t
+{
+    static constexpr uint32_t NUM_ROWS = ROWS;
+    static constexpr uint32_t NUM_COLS = COLS;
+    static constexpr uint32_t NUM_CELLS = ROWS * COLS;
+    static constexpr uint32_t STRIDE = COLS + 2;
+    static constexpr uint32_t NUM_SLOTS = (ROWS + 2) * STRIDE;
+    // type of the halo cells
+    static constexpr uint8_t WALL = 0xFF;
+    // slot offset of the neighbor in each neighbor_direction_t
+    static constexpr int32_t OFFSETS[NUM_NEIGHBORS] = {(int32_t)STRIDE, -(int32_t)STRIDE, 1, -1};
+
+    std::array<uint8_t, NUM_SLOTS> types;
+    std::array<int32_t, NUM_SLOTS> energies;
+    std::array<int32_t, NUM_SLOTS> ages;
+    std::array<uint8_t, NUM_SLOTS> dying;
+    std::array<uint8_t, NUM_SLOTS> processed;
+
+    void reset()
+    {
+        types.fill(WALL);
+        for (uint32_t i = 0; i < ROWS; i++)
+        {
+            for (uint32_t j = 0; j < COLS; j++)
+            {
+                types[slot(i, j)] = empty;
+            }
+        }
+        energies.fill(0);
+        ages.fill(0);
+        dying.fill(0);
+        processed.fill(0);
+    }
+
+    static constexpr uint32_t slot(uint32_t i, uint32_t j)
+    {
+        return (i + 1) * STRIDE + j + 1;
+    }
+
+    static constexpr uint32_t row(uint32_t s) { return s / STRIDE - 1; }
+    static constexpr uint32_t col(uint32_t s) { return s % STRIDE - 1; }
+
+    static constexpr uint32_t neighbor(uint32_t s, uint32_t direction)
+    {
+        return (uint32_t)((int32_t)s + OFFSETS[direction]);
+    }
+
+    entity_type_t type(uint32_t s) const { return (entity_type_t)types[s]; }
+
+    entity_t entity(uint32_t s) const
+    {
+        return {type(s), energies[s], ages[s]};
+    }
+
+    int32_t energy(uint32_t s) const { return energies[s]; }
+    int32_t age(uint32_t s) const { return ages[s]; }
+    void set_energy(uint32_t s, int32_t energy) { energies[s] = energy; }
+    void set_age(uint32_t s, int32_t age) { ages[s] = age; }
+    bool is_dying(uint32_t s) const { return dying[s]; }
+    void mark_dying(uint32_t s) { dying[s] = 1; }
+    void mark_processed(uint32_t s) { processed[s] = 1; }
+
+    // 4-bit mask (bit d for neighbor_direction_t d) of the neighbors of the
+    // slot holding the type
+    uint32_t neighbor_mask(entity_type_t type, uint32_t s) const
+    {
+        return (uint32_t)(types[neighbor(s, NEIGHBOR_DOWN)] == type) |
+               (uint32_t)(types[neighbor(s, NEIGHBOR_UP)] == type) << NEIGHBOR_UP |
+               (uint32_t)(types[neighbor(s, NEIGHBOR_RIGHT)] == type) << NEIGHBOR_RIGHT |
+               (uint32_t)(types[neighbor(s, NEIGHBOR_LEFT)] == type) << NEIGHBOR_LEFT;
+    }
+
+    void place(uint32_t s, entity_type_t type, int32_t energy, int32_t age)
+    {
+        types[s] = type;
+        energies[s] = energy;
+        ages[s] = age;
+        dying[s] = 0;
+    }
+
+    void clear(uint32_t s)
+    {
+        place(s, empty, 0, 0);
+    }
+};
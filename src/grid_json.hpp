@@ -0,0 +1,92 @@
+#pragma once
+
+#include "parallel.hpp"
+#include "world.hpp"
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// The JSON text of one entity never takes more than this many bytes
+static const uint32_t MAXIMUM_ENTITY_JSON = 64;
+
+// Writes the JSON object of the entity at out and returns the end of the
+// text. The text is the one nlohmann::json dumps for it, keys sorted, e.g.
+// {"age":3,"energy":0,"type":"P"}.
+inline char *write_entity_json(char *out, const entity_t &e)
+{
+    static const char TYPE_CHARS[] = {' ', 'P', 'H', 'C'};
+    static const char AGE[] = "{\"age\":";
+    static const char ENERGY[] = ",\"energy\":";
+    static const char TYPE[] = ",\"type\":\"";
+    char *end = out + MAXIMUM_ENTITY_JSON;
+    out = (char *)std::memcpy(out, AGE, sizeof(AGE) - 1) + sizeof(AGE) - 1;
+    out = std::to_chars(out, end, e.age).ptr;
+    out = (char *)std::memcpy(out, ENERGY, sizeof(ENERGY) - 1) + sizeof(ENERGY) - 1;
+    out = std::to_chars(out, end, e.energy).ptr;
+    out = (char *)std::memcpy(out, TYPE, sizeof(TYPE) - 1) + sizeof(TYPE) - 1;
+    *out++ = TYPE_CHARS[e.type];
+    *out++ = '"';
+    *out++ = '}';
+    return out;
+}
+
+// Row-major JSON matrix of a rows x cols grid, written straight into the text
+// with no intermediate DOM. fill_row(i, row) copies the entities of row i to
+// row[0, cols). Rows are split across the workers in two passes, the first
+// measuring the text of every row and the second writing it in place, so the
+// text is the only copy of the grid held in memory (about 35 bytes per cell).
+template <typename row_fn_t>
+std::string grid_to_json(uint32_t rows, uint32_t cols, row_fn_t fill_row)
+{
+    if (rows == 0)
+        return "[]";
+    // row i takes text[inicio[i], inicio[i + 1] - 1), followed by a comma or,
+    // after the last row, the closing bracket
+    std::vector<uint64_t> inicio(rows + 1, 0);
+    parallel_for(
+        rows, [cols, &fill_row, &inicio](uint64_t begin, uint64_t end)
+        {
+            std::vector<entity_t> linha(cols);
+            char buffer[MAXIMUM_ENTITY_JSON];
+            for (uint64_t i = begin; i < end; i++)
+            {
+                fill_row((uint32_t)i, linha.data());
+                uint64_t tamanho = 1 + cols; // brackets and commas
+                for (uint32_t j = 0; j < cols; j++)
+                {
+                    tamanho += write_entity_json(buffer, linha[j]) - buffer;
+                }
+                inicio[i + 1] = tamanho + 1;
+            } },
+        16);
+    inicio[0] = 1;
+    for (uint32_t i = 0; i < rows; i++)
+    {
+        inicio[i + 1] += inicio[i];
+    }
+
+    std::string text(inicio[rows], '\0');
+    text[0] = '[';
+    parallel_for(
+        rows, [rows, cols, &fill_row, &inicio, &text](uint64_t begin, uint64_t end)
+        {
+            std::vector<entity_t> linha(cols);
+            for (uint64_t i = begin; i < end; i++)
+            {
+                fill_row((uint32_t)i, linha.data());
+                char *out = &text[inicio[i]];
+                *out++ = '[';
+                for (uint32_t j = 0; j < cols; j++)
+                {
+                    if (j > 0)
+                        *out++ = ',';
+                    out = write_entity_json(out, linha[j]);
+                }
+                *out++ = ']';
+                *out = i + 1 < rows ? ',' : ']';
+            } },
+        16);
+    return text;
+}
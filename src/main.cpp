@@ -3,12 +3,29 @@
 
 #include "crow_all.h"
 #include "json.hpp"
+#include "aging.hpp"
+#include "counter_rng.hpp"
+#include "fixed_grid.hpp"
+#include "grid_json.hpp"
+#include "radix_sort.hpp"
+#include "sparse_world.hpp"
+#include "world.hpp"
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <random>
 #include <thread>
 #include <mutex>
 
-static const uint32_t NUM_ROWS = 15;
+// World size used when /start-simulation does not ask for one
+static const uint32_t DEFAULT_NUM_ROWS = 15;
+static const uint32_t DEFAULT_NUM_COLS = 15;
+// Upper bound on rows * cols accepted by /start-simulation. Every response
+// carries the whole grid as JSON, about 32 bytes per cell: at 4000 x 4000 a
+// response takes about 3 s and the server peaks under 1 GB.
+static const uint64_t MAXIMUM_NUM_CELLS = 16000000;
+// Upper bound on the ticks run by a single /advance request
+static const uint64_t MAXIMUM_ADVANCE_STEPS = 1000000;
 
 // Constants
 const uint32_t PLANT_MAXIMUM_AGE = 10;
@@ -26,14 +43,14 @@ const double HERBIVORE_EAT_PROBABILITY = 0.9;
 const double CARNIVORE_MOVE_PROBABILITY = 0.5;
 const double CARNIVORE_EAT_PROBABILITY = 1.0;
 
-// Type definitions
-enum entity_type_t
-{
-    empty,
-    plant,
-    herbivore,
-    carnivore
-};
+// Probabilities as thresholds on a uniform 32-bit draw
+const uint64_t PLANT_REPRODUCTION_THRESHOLD = probability_threshold(PLANT_REPRODUCTION_PROBABILITY);
+const uint64_t HERBIVORE_REPRODUCTION_THRESHOLD = probability_threshold(HERBIVORE_REPRODUCTION_PROBABILITY);
+const uint64_t CARNIVORE_REPRODUCTION_THRESHOLD = probability_threshold(CARNIVORE_REPRODUCTION_PROBABILITY);
+const uint64_t HERBIVORE_MOVE_THRESHOLD = probability_threshold(HERBIVORE_MOVE_PROBABILITY);
+const uint64_t HERBIVORE_EAT_THRESHOLD = probability_threshold(HERBIVORE_EAT_PROBABILITY);
+const uint64_t CARNIVORE_MOVE_THRESHOLD = probability_threshold(CARNIVORE_MOVE_PROBABILITY);
+const uint64_t CARNIVORE_EAT_THRESHOLD = probability_threshold(CARNIVORE_EAT_PROBABILITY);
 
 struct pos_t
 {
@@ -41,477 +58,1269 @@ struct pos_t
     uint32_t j;
 };
 
-struct entity_t
-{
-    entity_type_t type;
-    int32_t energy;
-    int32_t age;
-    std::mutex mtx;
-};
+// Grid that contains the entities
+static world_t world;
 
+// Seed of the current simulation and number of ticks run since it started.
+// Every random draw is a function of (seed, tick, cell, draw index), see
+// start_cell_stream(), so a seed replays the same run at any thread count.
+static uint64_t simulation_seed = 0;
+static uint64_t current_tick = 0;
+static thread_local rng_stream_t rng;
+// Stream used by the initial placement, before the first tick
+static const uint32_t PLACEMENT_STREAM = UINT32_MAX;
+// Stream of the draws that shuffle the color phases of a tick
+static const uint32_t ORDER_STREAM = UINT32_MAX - 1;
+
+// Seeds used when /start-simulation does not pass one
 static std::random_device rd;
-static std::mt19937 gen(rd());
+
+// Streams of the entities a worker is about to run, generated in SIMD batches
+static thread_local rng_prefetch_t rng_prefetch;
+static thread_local std::vector<uint32_t> fluxos_prefetch;
+// Entities whose streams are prefetched in one batch
+static const uint64_t PREFETCH_CHUNK = 256;
+
+// Stream of the entity in cell (i, j). Streams are keyed by the logical
+// row-major id of the cell, not by its storage index, so a different memory
+// layout draws the same numbers.
+uint32_t cell_stream(uint32_t i, uint32_t j, uint32_t num_cols)
+{
+    return (uint32_t)((uint64_t)i * num_cols + j);
+}
+
+// Points the thread's stream at the draws of the entity in cell (i, j) for the
+// current tick, starting from its prefetched blocks when there are any
+void start_cell_stream(uint32_t i, uint32_t j, uint32_t num_cols, const uint32_t *prefetched)
+{
+    rng.start(simulation_seed, current_tick, cell_stream(i, j, num_cols), prefetched,
+              prefetched ? PREFETCHED_WORDS : 0);
+}
+
+// Computes the prefetched blocks of the entities in celulas[0, count)
+void prefetch_cell_streams(const uint64_t *celulas, uint64_t count)
+{
+    fluxos_prefetch.resize(count);
+    for (uint64_t k = 0; k < count; k++)
+    {
+        fluxos_prefetch[k] = cell_stream(world.row_of(celulas[k]), world.col_of(celulas[k]), world.num_cols);
+    }
+    rng_prefetch.fill(simulation_seed, current_tick, fluxos_prefetch.data(), (uint32_t)count);
+}
+
 // FUNÇÕES
-//  Function to generate a random action based on probability
-bool random_action(float probability)
+//  Function to generate a random action based on probability, given as a
+//  threshold built with probability_threshold()
+bool random_action(uint64_t threshold)
+{
+    return rng.chance(threshold);
+}
+// Snapshot of the occupied cells taken at the start of each iteration
+std::vector<uint64_t> celulas_ocupadas;
+
+// Where the cells live
+//  - dense_storage: `world`, one flat grid of rows x cols cells
+//  - sparse_storage: `sparse`, chunks allocated as entities enter them and
+//    freed once empty, with no edges. Entities may wander anywhere; rows and
+//    cols only frame the initial placement and the window returned as JSON,
+//    rows 0 .. rows - 1 and columns 0 .. cols - 1.
+//  - fixed_storage: one of the grids sized at compile time (see
+//    with_fixed_grid()), picked instead of `world` when a dense session can
+//    run on one
+enum storage_t
+{
+    dense_storage,
+    sparse_storage,
+    fixed_storage
+};
+static storage_t storage = dense_storage;
+static sparse_world_t sparse;
+// Size of the grid returned as JSON when the cells are not in `world`
+static uint32_t view_rows = 0;
+static uint32_t view_cols = 0;
+
+// Grid sizes with an engine specialized at compile time, the default size
+// and a few other small ones
+template <uint32_t ROWS, uint32_t COLS>
+fixed_grid_t<ROWS, COLS> &fixed_grid()
+{
+    static fixed_grid_t<ROWS, COLS> grade;
+    return grade;
+}
+
+template <uint32_t ROWS, uint32_t COLS, typename fn_t>
+bool try_fixed_grid(uint32_t rows, uint32_t cols, fn_t &fn)
+{
+    if (rows != ROWS || cols != COLS)
+        return false;
+    fn(fixed_grid<ROWS, COLS>());
+    return true;
+}
+
+// Calls fn with the fixed grid of the size, if there is one, so generic
+// lambdas reach the engine specialized for it; false when there is none
+template <typename fn_t>
+bool with_fixed_grid(uint32_t rows, uint32_t cols, fn_t fn)
 {
-    // static std::random_device rd;
-    // static std::mt19937 gen(rd());
-    std::uniform_real_distribution<> dis(0.0, 1.0);
-    return dis(gen) < probability;
+    return try_fixed_grid<10, 10>(rows, cols, fn) ||
+           try_fixed_grid<DEFAULT_NUM_ROWS, DEFAULT_NUM_COLS>(rows, cols, fn) ||
+           try_fixed_grid<20, 20>(rows, cols, fn) ||
+           try_fixed_grid<30, 30>(rows, cols, fn) ||
+           try_fixed_grid<50, 50>(rows, cols, fn);
 }
-// Auxiliary code to convert the entity_type_t enum to a string
-NLOHMANN_JSON_SERIALIZE_ENUM(entity_type_t, {
-                                                {empty, " "},
-                                                {plant, "P"},
-                                                {herbivore, "H"},
-                                                {carnivore, "C"},
-                                            })
 
-// Auxiliary code to convert the entity_t struct to a JSON object
-namespace nlohmann
+// Converts the world to the row-major JSON matrix consumed by the web page
+// (see grid_to_json()); the sparse world is read one chunk lookup per row and
+// chunk column
+std::string world_to_json()
 {
-    void to_json(nlohmann::json &j, const entity_t &e)
+    if (storage == sparse_storage)
+        return grid_to_json(view_rows, view_cols, [](uint32_t i, entity_t *linha)
+                            {
+            sparse_cell_t celula = sparse.cell(i, 0);
+            for (uint32_t j = 0; j < view_cols; j++)
+            {
+                celula.lj = j % CHUNK_SIZE;
+                if (j > 0 && celula.lj == 0)
+                    celula = sparse.cell(i, j);
+                linha[j] = sparse.entity(celula);
+            } });
+    if (storage == fixed_storage)
     {
-        j = nlohmann::json{{"type", e.type}, {"energy", e.energy}, {"age", e.age}};
+        std::string json_grid;
+        with_fixed_grid(view_rows, view_cols, [&json_grid](const auto &grade)
+                        {
+            json_grid = grid_to_json(view_rows, view_cols, [&grade](uint32_t i, entity_t *linha)
+                                     {
+                for (uint32_t j = 0; j < view_cols; j++)
+                {
+                    linha[j] = grade.entity(grade.slot(i, j));
+                } }); });
+        return json_grid;
     }
+    return grid_to_json(world.num_rows, world.num_cols, [](uint32_t i, entity_t *linha)
+                        {
+        for (uint32_t j = 0; j < world.num_cols; j++)
+        {
+            linha[j] = world.entity(world.index(i, j));
+        } });
 }
 
-// Grid that contains the entities
-static std::vector<std::vector<entity_t>> entity_grid;
-std::vector<std::pair<int, int>> pares_analisados;
-std::vector<std::pair<int, int>> posicoes_disponiveis;
-
-void simulate_plant(int i, int j)
-{   
-    entity_grid[i][j].mtx.lock();
-    entity_grid[i-1][j].mtx.lock();
-    entity_grid[i+1][j].mtx.lock();
-    entity_grid[i][j-1].mtx.lock();
-    entity_grid[i][j+1].mtx.lock();
-    if (entity_grid[i][j].age == PLANT_MAXIMUM_AGE)
-    {
-        entity_grid[i][j].type = empty;
-        entity_grid[i][j].energy = 0;
-        entity_grid[i][j].age = 0;
+// How the asynchronous (in place) update runs the entities of a tick
+//  - serial_schedule: one entity at a time, in storage order (row-major
+//    unless built with ECOSIM_BLOCKED_LAYOUT, see cell_layout.hpp)
+//  - colored_schedule: cells are split in 5 color classes, color(i, j) =
+//    (i + 2j) mod 5, and the classes run one after the other. Two cells of the
+//    same color are at least 3 steps apart, so their neighborhoods never overlap
+//    and all the entities of a class run in parallel without any lock.
+//  - locked_schedule: all the entities run in parallel, each one holding the
+//    locks of its cell and of its 4 neighbors while it acts (see locking_t
+//    for the kinds of locks)
+//  - tiled_schedule: the grid is split in TILE_SIZE x TILE_SIZE tiles. Each
+//    worker owns whole tiles and runs their interior cells, whose neighborhoods
+//    never leave the tile, without locks. The one cell thick ring around every
+//    tile (the halo shared with the neighboring tiles) runs afterwards with the
+//    colored schedule.
+enum async_schedule_t
+{
+    serial_schedule,
+    colored_schedule,
+    locked_schedule,
+    tiled_schedule
+};
+static async_schedule_t async_schedule = serial_schedule;
+static const uint32_t NUM_COLORS = 5;
+// 64 x 64 cells keep a tile's types, energies and ages within L2
+static const uint32_t TILE_SIZE = 64;
+
+uint32_t cell_color(uint32_t i, uint32_t j)
+{
+    return (uint32_t)(((uint64_t)i + 2 * (uint64_t)j) % NUM_COLORS);
+}
+
+// Locks guarding the neighborhood of (i, j), the cell and its existing
+// neighbors, in increasing id order and without repeats (in a small toroidal
+// world two neighbors may be the same cell, and striped cells may share a
+// lock); returns how many there are
+uint32_t neighborhood_locks(uint32_t i, uint32_t j, uint64_t travas[1 + NUM_NEIGHBORS])
+{
+    uint32_t n = 0;
+    travas[n++] = world.locks.lock_id(world.index(i, j));
+    uint32_t vizinhos = world.existing_neighbors(i, j);
+    for (uint32_t d = 0; d < NUM_NEIGHBORS; d++)
+    {
+        if ((vizinhos >> d) & 1)
+            travas[n++] = world.locks.lock_id(world.neighbor_index(i, j, d));
     }
-    else
+    std::sort(travas, travas + n);
+    return (uint32_t)(std::unique(travas, travas + n) - travas);
+}
+
+// Locks the cell (i, j) and its von Neumann neighbors (wrapped around in a
+// toroidal world). Locks are always taken in increasing id order, so two
+// entities waiting on each other's cells can never deadlock. Only the locked
+// schedule needs them.
+void lock_neighborhood(uint32_t i, uint32_t j)
+{
+    if (async_schedule != locked_schedule)
+        return;
+    uint64_t travas[1 + NUM_NEIGHBORS];
+    uint32_t n = neighborhood_locks(i, j, travas);
+    for (uint32_t k = 0; k < n; k++)
     {
-        entity_grid[i][j].age++;
-        if (random_action(PLANT_REPRODUCTION_PROBABILITY))
+        world.locks.lock(travas[k]);
+    }
+}
+
+void unlock_neighborhood(uint32_t i, uint32_t j)
+{
+    if (async_schedule != locked_schedule)
+        return;
+    uint64_t travas[1 + NUM_NEIGHBORS];
+    uint32_t n = neighborhood_locks(i, j, travas);
+    for (uint32_t k = n; k > 0; k--)
+    {
+        world.locks.unlock(travas[k - 1]);
+    }
+}
+
+// Species behavior as compile-time policies: ages, probabilities (as draw
+// thresholds) and energies. The kernels below are templates instantiated once
+// per species, and the steps a species does not have (eating when PREY is
+// empty, moving when MOVE_CHANCE is 0, starving when it has no energy) are
+// compiled out of its kernel.
+struct plant_policy_t
+{
+    static constexpr entity_type_t TYPE = plant;
+    static constexpr int32_t MAXIMUM_AGE = PLANT_MAXIMUM_AGE;
+    static constexpr bool AGE_IN_PLANES = true; // see plant_ages_t
+    static constexpr bool HAS_ENERGY = false;
+    static constexpr entity_type_t PREY = empty;
+    static constexpr uint64_t EAT_CHANCE = 0;
+    static constexpr int32_t ENERGY_PER_MEAL = 0;
+    static constexpr uint64_t REPRODUCTION_CHANCE = PLANT_REPRODUCTION_THRESHOLD;
+    static constexpr int32_t REPRODUCTION_THRESHOLD = 0;
+    static constexpr int32_t REPRODUCTION_COST = 0;
+    static constexpr int32_t OFFSPRING_ENERGY = 0;
+    static constexpr uint64_t MOVE_CHANCE = 0;
+    static constexpr int32_t MOVE_COST = 0;
+};
+
+static_assert(PLANT_MAXIMUM_AGE <= plant_ages_t::MAXIMUM_STORED_AGE, "plant ages must fit in the bit planes");
+
+struct herbivore_policy_t
+{
+    static constexpr entity_type_t TYPE = herbivore;
+    static constexpr int32_t MAXIMUM_AGE = HERBIVORE_MAXIMUM_AGE;
+    static constexpr bool AGE_IN_PLANES = false; // see plant_ages_t
+    static constexpr bool HAS_ENERGY = true;
+    static constexpr entity_type_t PREY = plant;
+    static constexpr uint64_t EAT_CHANCE = HERBIVORE_EAT_THRESHOLD;
+    static constexpr int32_t ENERGY_PER_MEAL = 30;
+    static constexpr uint64_t REPRODUCTION_CHANCE = HERBIVORE_REPRODUCTION_THRESHOLD;
+    static constexpr int32_t REPRODUCTION_THRESHOLD = THRESHOLD_ENERGY_FOR_REPRODUCTION;
+    static constexpr int32_t REPRODUCTION_COST = 10;
+    static constexpr int32_t OFFSPRING_ENERGY = 100;
+    static constexpr uint64_t MOVE_CHANCE = HERBIVORE_MOVE_THRESHOLD;
+    static constexpr int32_t MOVE_COST = 5;
+};
+
+struct carnivore_policy_t
+{
+    static constexpr entity_type_t TYPE = carnivore;
+    static constexpr int32_t MAXIMUM_AGE = CARNIVORE_MAXIMUM_AGE;
+    static constexpr bool AGE_IN_PLANES = false; // see plant_ages_t
+    static constexpr bool HAS_ENERGY = true;
+    static constexpr entity_type_t PREY = herbivore;
+    static constexpr uint64_t EAT_CHANCE = CARNIVORE_EAT_THRESHOLD;
+    static constexpr int32_t ENERGY_PER_MEAL = 30;
+    static constexpr uint64_t REPRODUCTION_CHANCE = CARNIVORE_REPRODUCTION_THRESHOLD;
+    static constexpr int32_t REPRODUCTION_THRESHOLD = THRESHOLD_ENERGY_FOR_REPRODUCTION;
+    static constexpr int32_t REPRODUCTION_COST = 10;
+    static constexpr int32_t OFFSPRING_ENERGY = 100;
+    static constexpr uint64_t MOVE_CHANCE = CARNIVORE_MOVE_THRESHOLD;
+    static constexpr int32_t MOVE_COST = 5;
+};
+
+// Calls fn with a value of the policy type of the species (nothing for empty
+// cells), so generic lambdas can reach the specialized kernels
+template <typename fn_t>
+void with_species(entity_type_t type, fn_t fn)
+{
+    switch (type)
+    {
+    case plant:
+        fn(plant_policy_t());
+        break;
+    case herbivore:
+        fn(herbivore_policy_t());
+        break;
+    case carnivore:
+        fn(carnivore_policy_t());
+        break;
+    default:
+        break;
+    }
+}
+
+// Collects the neighbors of (i, j) whose bits are set in the neighbor mask, in
+// the order down, up, right, left
+uint32_t neighbors_in_mask(uint32_t i, uint32_t j, uint32_t mask, uint64_t vizinhos[4])
+{
+    uint32_t n = 0;
+    for (uint32_t d = 0; d < NUM_NEIGHBORS; d++)
+    {
+        if ((mask >> d) & 1)
+            vizinhos[n++] = world.neighbor_index(i, j, d);
+    }
+    return n;
+}
+
+// Draws one of the neighbors of a non-empty neighbor mask and returns its
+// direction, with no candidate list and no branch
+uint32_t random_direction(uint32_t mask)
+{
+    return NEIGHBOR_CHOICES.direction[mask][rng.below(NEIGHBOR_CHOICES.count[mask])];
+}
+
+// One entity of the species acting in place on a grid (async update). The
+// kernel is written against the cell accessors world_t, sparse_world_t and
+// fixed_grid_t share, each with its own cell handle (world_cell_t,
+// sparse_cell_t and slot): is_dying(), neighbor_mask(), neighbor(), energy(),
+// set_energy(), age(), place(), clear() and mark_processed(). Every grid
+// therefore runs the same steps and the same draws.
+template <typename species_t, typename grid_t, typename cell_t>
+void simulate_entity(grid_t &grade, cell_t c)
+{
+    // already one year older, or flagged as dying, since the aging pass
+    if (grade.is_dying(c))
+    {
+        grade.clear(c);
+        return;
+    }
+    // ALIMENTAÇÃO
+    if constexpr (species_t::PREY != empty)
+    {
+        uint32_t presas = grade.neighbor_mask(species_t::PREY, c);
+        for (uint32_t d = 0; d < NUM_NEIGHBORS; d++)
         {
-            // analisa casas adjacentes e coloca as disponiveis em um vetor
-            if ((i + 1) < NUM_ROWS)
+            if (((presas >> d) & 1) && random_action(species_t::EAT_CHANCE))
             {
-                if (entity_grid[i + 1][j].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i + 1, j));
-                }
+                grade.clear(grade.neighbor(c, d));
+                grade.set_energy(c, std::min<int32_t>(grade.energy(c) + species_t::ENERGY_PER_MEAL, MAXIMUM_ENERGY));
             }
-            if (i > 0)
+        }
+    }
+    // REPRODUÇÃO
+    if (random_action(species_t::REPRODUCTION_CHANCE) &&
+        (!species_t::HAS_ENERGY || grade.energy(c) >= species_t::REPRODUCTION_THRESHOLD))
+    {
+        uint32_t livres = grade.neighbor_mask(empty, c);
+        if (livres != 0)
+        {
+            cell_t alvo = grade.neighbor(c, random_direction(livres));
+            grade.place(alvo, species_t::TYPE, species_t::OFFSPRING_ENERGY, 0);
+            if constexpr (species_t::HAS_ENERGY)
             {
-                if (entity_grid[i - 1][j].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i - 1, j));
-                }
+                // perde energia
+                grade.set_energy(c, grade.energy(c) - species_t::REPRODUCTION_COST);
             }
-            if ((j + 1) < NUM_ROWS)
+            grade.mark_processed(alvo);
+        }
+    }
+    // MOVIMENTAÇÃO
+    if constexpr (species_t::MOVE_CHANCE > 0)
+    {
+        if (random_action(species_t::MOVE_CHANCE))
+        {
+            uint32_t livres = grade.neighbor_mask(empty, c);
+            if (livres != 0)
             {
-                if (entity_grid[i][j + 1].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i, j + 1));
-                }
+                cell_t alvo = grade.neighbor(c, random_direction(livres));
+                grade.place(alvo, species_t::TYPE, grade.energy(c) - species_t::MOVE_COST, grade.age(c));
+                // limpa a antiga
+                grade.clear(c);
+                grade.mark_processed(alvo);
             }
-            if (j > 0)
+        }
+    }
+}
+
+// Update modes
+//  - async_update: entities act one at a time directly on the grid, so each one
+//    sees what the previous ones did during the same tick
+//  - sync_update: every entity decides from the state of tick N in
+//    world.cells and tick N+1 is built in world.next_cells
+enum update_mode_t
+{
+    async_update,
+    sync_update
+};
+static update_mode_t update_mode = async_update;
+
+// Fills celulas_ocupadas with the occupied cells in storage order
+void snapshot_occupied_cells()
+{
+    celulas_ocupadas.clear();
+    celulas_ocupadas.reserve(world.active.size());
+    for (uint8_t tipo : {plant, herbivore, carnivore})
+    {
+        const std::vector<uint64_t> &lista = world.active.of(tipo);
+        celulas_ocupadas.insert(celulas_ocupadas.end(), lista.begin(), lista.end());
+    }
+    std::sort(celulas_ocupadas.begin(), celulas_ocupadas.end());
+}
+
+// Order in which the entities of a tick act
+//  - storage_order: the order the cells are stored in, so the entities at the
+//    top left always act first and win every conflict
+//  - random_order: a new random permutation every tick. Each entity gets a
+//    key drawn from the stream of its cell for the tick (stream_keys()) and
+//    the keys are sorted with parallel_radix_sort(), so the permutation only
+//    depends on the seed and the tick. The async schedules run the entities
+//    in that order and the color phases in a random order; the sync mode
+//    still visits the entities in storage order but ranks their claims by
+//    the permutation.
+enum update_order_t
+{
+    storage_order,
+    random_order
+};
+static update_order_t update_order = storage_order;
+
+// Random keys of the tick, each in the high half of a word whose low half is
+// the position of the entity in the snapshot; sorted, they give the permutation
+std::vector<uint64_t> chaves_ordem;
+std::vector<uint64_t> chaves_auxiliares;
+// Position of each snapshot entry in the permutation (sync claim ranks)
+std::vector<uint32_t> posicao_sorteada;
+
+// Sorts the entities of celulas by random keys of the tick into chaves_ordem
+void random_permutation(const std::vector<uint64_t> &celulas)
+{
+    chaves_ordem.resize(celulas.size());
+    parallel_for(celulas.size(), [&celulas](uint64_t begin, uint64_t end)
+                 {
+        uint32_t fluxos[PREFETCH_CHUNK];
+        uint32_t chaves[PREFETCH_CHUNK];
+        for (uint64_t inicio = begin; inicio < end; inicio += PREFETCH_CHUNK)
+        {
+            uint64_t n = std::min(PREFETCH_CHUNK, end - inicio);
+            for (uint64_t k = 0; k < n; k++)
             {
-                if (entity_grid[i][j - 1].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i, j - 1));
-                }
+                uint64_t celula = celulas[inicio + k];
+                fluxos[k] = cell_stream(world.row_of(celula), world.col_of(celula), world.num_cols);
             }
-            if (!posicoes_disponiveis.empty())
+            stream_keys(simulation_seed, current_tick, fluxos, n, chaves);
+            for (uint64_t k = 0; k < n; k++)
             {
-                std::uniform_int_distribution<> dis(0, posicoes_disponiveis.size() - 1);
-                int sorteio = dis(gen);
-                int x = posicoes_disponiveis[sorteio].first;
-                int y = posicoes_disponiveis[sorteio].second;
-                std::cout << "sorteio" << sorteio << "\n"
-                          << x << "\n"
-                          << y << "\n";
-                entity_grid[x][y].type = plant;
-                pares_analisados.push_back(std::make_pair(x, y));
-                posicoes_disponiveis.clear();
+                chaves_ordem[inicio + k] = (uint64_t)chaves[k] << 32 | (inicio + k);
             }
-        }
+        } });
+    parallel_radix_sort(chaves_ordem, chaves_auxiliares, 32);
+}
+
+// Puts the cells of celulas_ocupadas in the random order of the tick
+void shuffle_occupied_cells()
+{
+    random_permutation(celulas_ocupadas);
+    chaves_auxiliares.resize(celulas_ocupadas.size());
+    parallel_for(celulas_ocupadas.size(), [](uint64_t begin, uint64_t end)
+                 {
+        for (uint64_t k = begin; k < end; k++)
+        {
+            chaves_auxiliares[k] = celulas_ocupadas[(uint32_t)chaves_ordem[k]];
+        } });
+    celulas_ocupadas.swap(chaves_auxiliares);
+}
+
+// Ranks the entries of celulas_ocupadas by the random order of the tick
+void rank_occupied_cells()
+{
+    random_permutation(celulas_ocupadas);
+    posicao_sorteada.resize(celulas_ocupadas.size());
+    parallel_for(celulas_ocupadas.size(), [](uint64_t begin, uint64_t end)
+                 {
+        for (uint64_t k = begin; k < end; k++)
+        {
+            posicao_sorteada[(uint32_t)chaves_ordem[k]] = (uint32_t)k;
+        } });
+}
+
+// Claim rank of the k-th entity of the snapshot in a sync tick
+uint32_t claim_rank(uint64_t k)
+{
+    return update_order == random_order ? posicao_sorteada[k] : (uint32_t)k;
+}
+
+// Ticks between two sorts of the active lists. Removals swap the last cell of
+// a list into the freed slot, so births and deaths scatter the lists over the
+// grid, and the passes that walk them (aging, snapshots) end up jumping
+// around memory; every so often they are put back in storage order.
+static const uint64_t ACTIVE_SORT_INTERVAL = 16;
+
+void sort_active_lists()
+{
+    if (current_tick % ACTIVE_SORT_INTERVAL != 0)
+        return;
+    parallel_for(
+        3, [](uint64_t begin, uint64_t end)
+        {
+            for (uint64_t tipo = begin; tipo < end; tipo++)
+            {
+                world.active.sort((uint8_t)(plant + tipo));
+            } },
+        1);
+}
+
+// Starts a new tick epoch: marks from the previous iteration stop counting
+void advance_processed_marks()
+{
+    if (world.processed.advance())
+    {
+        world.processed.clear(0, world.num_cells());
     }
-    entity_grid[i][j].mtx.unlock();
-    entity_grid[i-1][j].mtx.unlock();
-    entity_grid[i+1][j].mtx.unlock();
-    entity_grid[i][j-1].mtx.unlock();
-    entity_grid[i][j+1].mtx.unlock();
 }
-void simulate_herbivore(int i, int j)
+
+// Entities aged per batch by age_species()
+static const uint64_t AGING_CHUNK = 256;
+// Ages and energies of the batch, gathered in contiguous arrays
+static thread_local std::vector<int32_t> idades_lote;
+static thread_local std::vector<int32_t> energias_lote;
+static thread_local std::vector<uint8_t> morre_lote;
+
+// Aging of the entities of the species in celulas[0, n) of a grid with the
+// cell accessors of simulate_entity() (plus set_age() and mark_dying()): their
+// ages and energies are gathered in contiguous arrays, aged and tested for
+// death in SIMD lanes (age_entities()), and scattered back; the entities at
+// the end of their life are flagged as dying instead of aging. Species
+// without energy never starve.
+template <typename species_t, typename grid_t, typename cell_t>
+void age_cells(grid_t &grade, const cell_t *celulas, uint32_t n)
 {
-    entity_grid[i][j].mtx.lock();
-    entity_grid[i-1][j].mtx.lock();
-    entity_grid[i+1][j].mtx.lock();
-    entity_grid[i][j-1].mtx.lock();
-    entity_grid[i][j+1].mtx.lock();
-    if (entity_grid[i][j].age == HERBIVORE_MAXIMUM_AGE || entity_grid[i][j].energy <= 0)
+    idades_lote.resize(n);
+    energias_lote.resize(n);
+    morre_lote.resize(n);
+    for (uint32_t k = 0; k < n; k++)
+    {
+        idades_lote[k] = grade.age(celulas[k]);
+        energias_lote[k] = species_t::HAS_ENERGY ? grade.energy(celulas[k]) : 1;
+    }
+    age_entities(idades_lote.data(), energias_lote.data(), morre_lote.data(), n, species_t::MAXIMUM_AGE);
+    for (uint32_t k = 0; k < n; k++)
     {
-        entity_grid[i][j].type = empty;
-        entity_grid[i][j].energy = 0;
-        entity_grid[i][j].age = 0;
+        if (morre_lote[k])
+            grade.mark_dying(celulas[k]);
+        else
+            grade.set_age(celulas[k], idades_lote[k]);
     }
+}
+
+// Aging pre-pass of an animal species of `world`, over its active list in
+// batches of AGING_CHUNK entities
+template <typename species_t>
+void age_species()
+{
+    const std::vector<uint64_t> &lista = world.active.of(species_t::TYPE);
+    parallel_for(lista.size(), [&lista](uint64_t begin, uint64_t end)
+                 {
+        for (uint64_t inicio = begin; inicio < end; inicio += AGING_CHUNK)
+        {
+            age_cells<species_t>(world, lista.data() + inicio, (uint32_t)std::min(AGING_CHUNK, end - inicio));
+        } });
+}
+
+// Start of a tick: every entity grows one year older, or is flagged in
+// world.dying when it reached its maximum age or ran out of energy, and
+// leaves the grid on its turn. Deaths wait for the turn so that a dying
+// entity can still be eaten, and still blocks its cell, until then.
+void start_tick_aging()
+{
+    // plants age all at once, 64 cells per word operation
+    if (update_mode == sync_update)
+        world.for_each_plant_word([](uint32_t i, uint32_t w, uint64_t plantas)
+                                  { world.dying.merge(i, w, world.plant_ages.start_sync_tick(i, w, plantas, PLANT_MAXIMUM_AGE)); });
     else
+        world.for_each_plant_word([](uint32_t i, uint32_t w, uint64_t plantas)
+                                  { world.dying.merge(i, w, world.plant_ages.start_async_tick(i, w, plantas, PLANT_MAXIMUM_AGE)); });
+    age_species<herbivore_policy_t>();
+    age_species<carnivore_policy_t>();
+}
+
+// Runs the entity in the cell, if it is still there and did not act yet
+void simulate_cell(uint64_t celula, const uint32_t *sorteios)
+{
+    uint32_t i = world.row_of(celula);
+    uint32_t j = world.col_of(celula);
+    lock_neighborhood(i, j);
+    //caso a casa nao tenha sido analisada nesta iteracao
+    if (!world.processed.is_marked(celula)){
+        //a entidade pode ter sido comida ou ter saido da casa nesta iteracao
+        entity_type_t tipo = world.type(celula);
+        start_cell_stream(i, j, world.num_cols, sorteios);
+        with_species(tipo, [i, j](auto especie)
+                     { simulate_entity<decltype(especie)>(world, world.cell(i, j)); });
+    }
+    unlock_neighborhood(i, j);
+}
+
+// Runs the entities of celulas[0, count) in order, prefetching their random
+// streams chunk by chunk
+void simulate_cells(const uint64_t *celulas, uint64_t count)
+{
+    for (uint64_t inicio = 0; inicio < count; inicio += PREFETCH_CHUNK)
     {
-        entity_grid[i][j].age++;
-        if ((i + 1) < NUM_ROWS)
+        uint64_t n = std::min(PREFETCH_CHUNK, count - inicio);
+        prefetch_cell_streams(celulas + inicio, n);
+        for (uint64_t k = 0; k < n; k++)
         {
-            if (entity_grid[i + 1][j].type == plant)
-            {
-                if (random_action(HERBIVORE_EAT_PROBABILITY))
-                {
-                    entity_grid[i + 1][j].type = empty;
-                    entity_grid[i + 1][j].age = 0;
-                    entity_grid[i + 1][j].energy = 0;
-                    entity_grid[i][j].energy = entity_grid[i][j].energy + 30;
-                }
-            }
+            simulate_cell(celulas[inicio + k], rng_prefetch.of((uint32_t)k));
         }
-        if (i > 0)
+    }
+}
+
+// Entities of each color class, in storage order
+std::vector<uint64_t> celulas_por_cor[NUM_COLORS];
+
+// Runs the entities of the given cells in the 5 color phases
+void run_colored_phases(const std::vector<uint64_t> &celulas)
+{
+    for (std::vector<uint64_t> &cor : celulas_por_cor)
+    {
+        cor.clear();
+    }
+    for (uint64_t celula : celulas)
+    {
+        uint32_t i = world.row_of(celula);
+        uint32_t j = world.col_of(celula);
+        celulas_por_cor[cell_color(i, j)].push_back(celula);
+    }
+    uint32_t cores[NUM_COLORS] = {0, 1, 2, 3, 4};
+    if (update_order == random_order)
+    {
+        rng.start(simulation_seed, current_tick, ORDER_STREAM);
+        for (uint32_t c = NUM_COLORS - 1; c > 0; c--)
         {
-            if (entity_grid[i - 1][j].type == plant)
-            {
-                if (random_action(HERBIVORE_EAT_PROBABILITY))
-                {
-                    entity_grid[i - 1][j].type = empty;
-                    entity_grid[i - 1][j].age = 0;
-                    entity_grid[i - 1][j].energy = 0;
-                    entity_grid[i][j].energy = entity_grid[i][j].energy + 30;
-                }
-            }
+            std::swap(cores[c], cores[rng.below(c + 1)]);
         }
-        if ((j + 1) < NUM_ROWS)
+    }
+    world.defer_active = true;
+    for (uint32_t c : cores)
+    {
+        const std::vector<uint64_t> &cor = celulas_por_cor[c];
+        parallel_for(cor.size(), [&cor](uint64_t begin, uint64_t end)
+                     {
+            simulate_cells(cor.data() + begin, end - begin); });
+    }
+    world.defer_active = false;
+    world.flush_active();
+}
+
+// Interior entities grouped by tile (tile t owns celulas_interiores[inicio_tile[t]
+// .. inicio_tile[t + 1])) and the entities on the tile rings
+std::vector<uint64_t> inicio_tile;
+std::vector<uint64_t> celulas_interiores;
+std::vector<uint64_t> celulas_de_borda;
+
+// True for the cells on the ring of their tile. In a toroidal world the last
+// row and column of the grid join the ring too, since their wrapped neighbors
+// belong to the first tiles.
+bool on_tile_ring(uint32_t i, uint32_t j)
+{
+    uint32_t li = i % TILE_SIZE;
+    uint32_t lj = j % TILE_SIZE;
+    if (li == 0 || lj == 0 || li == TILE_SIZE - 1 || lj == TILE_SIZE - 1)
+        return true;
+    return world.boundary == toroidal_boundary && (i == world.num_rows - 1 || j == world.num_cols - 1);
+}
+
+void run_tiled_phases()
+{
+    uint64_t tiles_por_linha = (world.num_cols + TILE_SIZE - 1) / TILE_SIZE;
+    uint64_t tiles_por_coluna = (world.num_rows + TILE_SIZE - 1) / TILE_SIZE;
+    uint64_t num_tiles = tiles_por_linha * tiles_por_coluna;
+
+    // counting sort of the interior entities by tile, keeping storage order
+    // inside each tile
+    inicio_tile.assign(num_tiles + 1, 0);
+    celulas_de_borda.clear();
+    for (uint64_t celula : celulas_ocupadas)
+    {
+        uint32_t i = world.row_of(celula);
+        uint32_t j = world.col_of(celula);
+        if (on_tile_ring(i, j))
+            celulas_de_borda.push_back(celula);
+        else
+            inicio_tile[(i / TILE_SIZE) * tiles_por_linha + j / TILE_SIZE + 1]++;
+    }
+    for (uint64_t t = 0; t < num_tiles; t++)
+    {
+        inicio_tile[t + 1] += inicio_tile[t];
+    }
+    celulas_interiores.resize(inicio_tile[num_tiles]);
+    std::vector<uint64_t> cursor(inicio_tile.begin(), inicio_tile.end() - 1);
+    for (uint64_t celula : celulas_ocupadas)
+    {
+        uint32_t i = world.row_of(celula);
+        uint32_t j = world.col_of(celula);
+        if (!on_tile_ring(i, j))
+            celulas_interiores[cursor[(i / TILE_SIZE) * tiles_por_linha + j / TILE_SIZE]++] = celula;
+    }
+
+    world.defer_active = true;
+    parallel_for(
+        num_tiles, [](uint64_t begin, uint64_t end)
         {
-            if (entity_grid[i][j + 1].type == plant)
+            for (uint64_t t = begin; t < end; t++)
             {
-                if (random_action(HERBIVORE_EAT_PROBABILITY))
-                {
-                    entity_grid[i][j + 1].type = empty;
-                    entity_grid[i][j + 1].age = 0;
-                    entity_grid[i][j + 1].energy = 0;
-                    entity_grid[i][j].energy = entity_grid[i][j].energy + 30;
-                }
-            }
-        }
-        if (j > 0)
+                simulate_cells(celulas_interiores.data() + inicio_tile[t], inicio_tile[t + 1] - inicio_tile[t]);
+            } },
+        1);
+    world.defer_active = false;
+    world.flush_active();
+
+    run_colored_phases(celulas_de_borda);
+}
+
+void run_async_tick()
+{
+    //Analisa as casas ocupadas, na ordem em que estão guardadas
+    sort_active_lists();
+    snapshot_occupied_cells();
+    // the entities of a color class never meet, so only the phases are shuffled
+    if (update_order == random_order && async_schedule != colored_schedule)
+        shuffle_occupied_cells();
+    advance_processed_marks();
+    start_tick_aging();
+    if (async_schedule == colored_schedule)
+    {
+        run_colored_phases(celulas_ocupadas);
+        return;
+    }
+    if (async_schedule == tiled_schedule)
+    {
+        run_tiled_phases();
+        return;
+    }
+    if (async_schedule == locked_schedule)
+    {
+        world.defer_active = true;
+        parallel_for(celulas_ocupadas.size(), [](uint64_t begin, uint64_t end)
+                     {
+            simulate_cells(celulas_ocupadas.data() + begin, end - begin); });
+        world.defer_active = false;
+        world.flush_active();
+        return;
+    }
+    simulate_cells(celulas_ocupadas.data(), celulas_ocupadas.size());
+}
+
+static const uint64_t NO_CELL = UINT64_MAX;
+
+// What an entity decided to do in a synchronous tick. Intents only read
+// world.cells, so they do not depend on the order entities are visited in.
+struct intent_t
+{
+    uint64_t source;
+    entity_type_t type;
+    bool dies;
+    uint8_t num_prey;
+    uint64_t prey[4];
+    uint64_t birth_target;
+    uint64_t move_target;
+};
+
+std::vector<intent_t> intencoes;
+std::vector<int32_t> energias;
+
+// Draws one of the neighbors of (i, j) in the non-empty mask and removes it
+// from the mask
+uint64_t take_random(uint32_t i, uint32_t j, uint32_t &mask)
+{
+    uint32_t direcao = random_direction(mask);
+    mask &= ~(1u << direcao);
+    return world.neighbor_index(i, j, direcao);
+}
+
+// Neighbor words of the row word the last intent of this worker was computed
+// in, for the types intents look for. The grid does not change while intents
+// are computed and the entities come in storage order, so consecutive
+// entities mostly share a word and the bitboard kernels run once per word (in
+// the blocked layout, once per few entities: a block row spans 16 columns).
+struct neighbor_cache_t
+{
+    uint64_t round = 0; // sync tick the words were computed in
+    uint32_t i = 0;
+    uint32_t w = 0;
+    neighbor_words_t of_type[3]; // empty, plant and herbivore neighbors
+};
+static uint64_t intent_round = 0;
+static thread_local neighbor_cache_t vizinhanca;
+
+const neighbor_cache_t &neighbor_words_at(uint32_t i, uint32_t w)
+{
+    if (vizinhanca.round != intent_round || vizinhanca.i != i || vizinhanca.w != w)
+    {
+        vizinhanca.round = intent_round;
+        vizinhanca.i = i;
+        vizinhanca.w = w;
+        for (entity_type_t tipo : {empty, plant, herbivore})
         {
-            if (entity_grid[i][j - 1].type == plant)
-            {
-                if (random_action(HERBIVORE_EAT_PROBABILITY))
-                {
-                    entity_grid[i][j - 1].type = empty;
-                    entity_grid[i][j - 1].age = 0;
-                    entity_grid[i][j - 1].energy = 0;
-                    entity_grid[i][j].energy = entity_grid[i][j].energy + 30;
-                }
-            }
+            vizinhanca.of_type[tipo] = world.neighbor_words(tipo, i, w);
         }
-        // REPRODUÇÃO
-        if (random_action(HERBIVORE_REPRODUCTION_PROBABILITY) && entity_grid[i][j].energy >= 20)
+    }
+    return vizinhanca;
+}
+
+// Decides what the entity of the species in cell (i, j) wants to do, reading
+// only world.cells
+template <typename species_t>
+void compute_intent(intent_t &intent, uint32_t i, uint32_t j)
+{
+    const uint64_t celula = world.index(i, j);
+    intent.source = celula;
+    intent.type = species_t::TYPE;
+    intent.dies = world.dying.test(i, j);
+    intent.num_prey = 0;
+    intent.birth_target = NO_CELL;
+    intent.move_target = NO_CELL;
+    if (intent.dies)
+        return;
+
+    const neighbor_cache_t &vizinhos = neighbor_words_at(i, j / 64);
+    if constexpr (species_t::PREY != empty)
+    {
+        uint64_t presas[4];
+        uint32_t num_presas = neighbors_in_mask(i, j, vizinhos.of_type[species_t::PREY].mask(j % 64), presas);
+        for (uint32_t k = 0; k < num_presas; k++)
         {
-            // analisa casas adjacentes e coloca as disponiveis em um vetor
-            if ((i + 1) < NUM_ROWS)
-            {
-                if (entity_grid[i + 1][j].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i + 1, j));
-                }
-            }
-            if (i > 0)
-            {
-                if (entity_grid[i - 1][j].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i - 1, j));
-                }
-            }
-            if ((j + 1) < NUM_ROWS)
-            {
-                if (entity_grid[i][j + 1].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i, j + 1));
-                }
-            }
-            if (j > 0)
-            {
-                if (entity_grid[i][j - 1].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i, j - 1));
-                }
-            }
-            if (!posicoes_disponiveis.empty())
-            {
-                std::uniform_int_distribution<> dis(0, posicoes_disponiveis.size() - 1);
-                int sorteio = dis(gen);
-                int x = posicoes_disponiveis[sorteio].first;
-                int y = posicoes_disponiveis[sorteio].second;
-                std::cout << "sorteio" << sorteio << "\n"
-                          << x << "\n"
-                          << y << "\n";
-                // reproduz
-                entity_grid[x][y].type = herbivore;
-                entity_grid[x][y].energy = 100;
-                // perde energia
-                entity_grid[i][j].energy = entity_grid[i][j].energy - 10;
-                pares_analisados.push_back(std::make_pair(x, y));
-                posicoes_disponiveis.clear();
-            }
+            if (random_action(species_t::EAT_CHANCE))
+                intent.prey[intent.num_prey++] = presas[k];
         }
-        // MOVIMENTAÇÃO
-        if (random_action(HERBIVORE_MOVE_PROBABILITY))
+    }
+    uint32_t livres = vizinhos.of_type[empty].mask(j % 64);
+    if (random_action(species_t::REPRODUCTION_CHANCE) && livres != 0)
+    {
+        // Whether the entity affords the birth depends on the meals it wins,
+        // known only at resolution. A birth it affords already is certain,
+        // so its cell leaves the move options; one that needs meals leaves
+        // them whole (see claim_targets()), and one it cannot afford even
+        // with every meal picks no cell.
+        int32_t energia = world.energy(celula);
+        int32_t energia_maxima = std::min<int32_t>(energia + intent.num_prey * species_t::ENERGY_PER_MEAL, MAXIMUM_ENERGY);
+        if (!species_t::HAS_ENERGY || energia >= species_t::REPRODUCTION_THRESHOLD)
+            intent.birth_target = take_random(i, j, livres);
+        else if (energia_maxima >= species_t::REPRODUCTION_THRESHOLD)
+            intent.birth_target = world.neighbor_index(i, j, random_direction(livres));
+    }
+    if constexpr (species_t::MOVE_CHANCE > 0)
+    {
+        if (random_action(species_t::MOVE_CHANCE) && livres != 0)
+            intent.move_target = take_random(i, j, livres);
+    }
+}
+
+void compute_intent(intent_t &intent, uint64_t celula, const uint32_t *sorteios)
+{
+    uint32_t i = world.row_of(celula);
+    uint32_t j = world.col_of(celula);
+    start_cell_stream(i, j, world.num_cols, sorteios);
+    with_species(world.type(celula), [&intent, i, j](auto especie)
+                 { compute_intent<decltype(especie)>(intent, i, j); });
+}
+
+// Phase 3 for the k-th entity, a survivor: collects the prey it won and claims
+// its birth and move targets
+template <typename species_t>
+void claim_targets(uint64_t k)
+{
+    intent_t &intent = intencoes[k];
+    if constexpr (species_t::PREY != empty)
+    {
+        for (uint32_t p = 0; p < intent.num_prey; p++)
         {
-            // analisa casas adjacentes e coloca as disponiveis em um vetor
-            if ((i + 1) < NUM_ROWS)
-            {
-                if (entity_grid[i + 1][j].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i + 1, j));
-                }
-            }
-            if (i > 0)
-            {
-                if (entity_grid[i - 1][j].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i - 1, j));
-                }
-            }
-            if ((j + 1) < NUM_ROWS)
-            {
-                if (entity_grid[i][j + 1].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i, j + 1));
-                }
-            }
-            if (j > 0)
-            {
-                if (entity_grid[i][j - 1].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i, j - 1));
-                }
-            }
-            if (!posicoes_disponiveis.empty())
-            {
-                std::uniform_int_distribution<> dis(0, posicoes_disponiveis.size() - 1);
-                int sorteio = dis(gen);
-                int x = posicoes_disponiveis[sorteio].first;
-                int y = posicoes_disponiveis[sorteio].second;
-                std::cout << "sorteio" << sorteio << "\n"
-                          << x << "\n"
-                          << y << "\n";
-
-                entity_grid[x][y].type = herbivore;
-                entity_grid[x][y].age = entity_grid[i][j].age;
-                entity_grid[x][y].energy = entity_grid[i][j].energy - 5;
-                // limpa a antiga
-                entity_grid[i][j].type = empty;
-                entity_grid[i][j].age = 0;
-                entity_grid[i][j].energy = 0;
-                pares_analisados.push_back(std::make_pair(x, y));
-                posicoes_disponiveis.clear();
-            }
+            if (world.claims.won(intent.prey[p], claim_rank(k)))
+                energias[k] = std::min<int32_t>(energias[k] + species_t::ENERGY_PER_MEAL, MAXIMUM_ENERGY);
         }
     }
-    entity_grid[i][j].mtx.unlock();
-    entity_grid[i-1][j].mtx.unlock();
-    entity_grid[i+1][j].mtx.unlock();
-    entity_grid[i][j-1].mtx.unlock();
-    entity_grid[i][j+1].mtx.unlock();
+    // a birth the meals did not pay for is dropped, and a move onto the cell
+    // of a birth that goes ahead is dropped in its favor
+    if (species_t::HAS_ENERGY && energias[k] < species_t::REPRODUCTION_THRESHOLD)
+        intent.birth_target = NO_CELL;
+    if (intent.move_target == intent.birth_target)
+        intent.move_target = NO_CELL;
+    if (intent.birth_target != NO_CELL)
+        world.claims.claim(intent.birth_target, claim_rank(k));
+    if (intent.move_target != NO_CELL)
+        world.claims.claim(intent.move_target, claim_rank(k));
 }
-void simulate_carnivore(int i, int j)
+
+// Phase 4 for the k-th entity, a survivor: writes it and its offspring to the
+// next buffer, keeping only the targets it won
+template <typename species_t>
+void apply_intent(uint64_t k)
 {
-    entity_grid[i][j].mtx.lock();
-    entity_grid[i-1][j].mtx.lock();
-    entity_grid[i+1][j].mtx.lock();
-    entity_grid[i][j-1].mtx.lock();
-    entity_grid[i][j+1].mtx.lock();
-    if (entity_grid[i][j].age == CARNIVORE_MAXIMUM_AGE || entity_grid[i][j].energy <= 0)
+    intent_t &intent = intencoes[k];
+    cell_buffer_t &proximo = world.next_cells;
+    if (intent.birth_target != NO_CELL && world.claims.won(intent.birth_target, claim_rank(k)))
     {
-        entity_grid[i][j].type = empty;
-        entity_grid[i][j].energy = 0;
-        entity_grid[i][j].age = 0;
+        energias[k] -= species_t::REPRODUCTION_COST;
+        proximo.set(intent.birth_target, species_t::TYPE, species_t::OFFSPRING_ENERGY, 0);
     }
     else
     {
-        entity_grid[i][j].age++;
-        // COME COELHOS
-        if ((i + 1) < NUM_ROWS)
+        intent.birth_target = NO_CELL;
+    }
+    uint64_t destino = intent.source;
+    if (intent.move_target != NO_CELL && world.claims.won(intent.move_target, claim_rank(k)))
+    {
+        energias[k] -= species_t::MOVE_COST;
+        destino = intent.move_target;
+    }
+    else
+    {
+        intent.move_target = NO_CELL;
+    }
+    // start_tick_aging() already aged the entity; bit-sliced ages are brought
+    // forward by finish_sync_tick()
+    int32_t idade = species_t::AGE_IN_PLANES ? 0 : world.age(intent.source);
+    proximo.set(destino, species_t::TYPE, energias[k], idade);
+}
+
+// Synchronous tick, run as lock-free propose / arbitrate phases. Each phase
+// runs in parallel and entities post claims on world.claims; on every cell the
+// claim with the lowest rank wins, the rank being the entity's position in the
+// storage-order snapshot (so the lowest source cell wins, whatever the threads
+// do), or in the random permutation of the tick (see claim_rank()):
+//  1. entities compute their intents and carnivores claim the herbivores they
+//     want to eat;
+//  2. herbivores that were not claimed claim the plants they want to eat;
+//  3. predators collect the energy of the prey they won, then the surviving
+//     entities claim their birth target (if the energy after meals reaches
+//     the threshold) and their move target, both empty cells, a move onto
+//     the birth cell giving way to the birth;
+//  4. the winners are written to the next buffer: an eaten entity does nothing
+//     else this tick, and an entity whose move target went to someone else
+//     stays in place.
+void run_sync_tick()
+{
+    sort_active_lists();
+    snapshot_occupied_cells();
+    if (update_order == random_order)
+        rank_occupied_cells();
+    world.claims.advance();
+    intent_round++;
+    start_tick_aging();
+
+    uint64_t num_entidades = celulas_ocupadas.size();
+    intencoes.resize(num_entidades);
+    energias.resize(num_entidades);
+
+    parallel_for(num_entidades, [](uint64_t begin, uint64_t end)
+                 {
+        for (uint64_t k = begin; k < end; k++)
         {
-            if (entity_grid[i + 1][j].type == herbivore)
+            if ((k - begin) % PREFETCH_CHUNK == 0)
+                prefetch_cell_streams(celulas_ocupadas.data() + k, std::min(PREFETCH_CHUNK, end - k));
+            intent_t &intent = intencoes[k];
+            compute_intent(intent, celulas_ocupadas[k], rng_prefetch.of((uint32_t)((k - begin) % PREFETCH_CHUNK)));
+            energias[k] = world.energy(intent.source);
+            if (intent.type == carnivore && !intent.dies)
             {
-                if (random_action(CARNIVORE_EAT_PROBABILITY))
+                for (uint32_t p = 0; p < intent.num_prey; p++)
                 {
-                    entity_grid[i + 1][j].type = empty;
-                    entity_grid[i + 1][j].age = 0;
-                    entity_grid[i + 1][j].energy = 0;
-                    entity_grid[i][j].energy = entity_grid[i][j].energy + 30;
+                    world.claims.claim(intent.prey[p], claim_rank(k));
                 }
             }
-        }
-        if (i > 0)
+        } });
+
+    parallel_for(num_entidades, [](uint64_t begin, uint64_t end)
+                 {
+        for (uint64_t k = begin; k < end; k++)
         {
-            if (entity_grid[i - 1][j].type == herbivore)
+            const intent_t &intent = intencoes[k];
+            if (intent.type == herbivore && !intent.dies && !world.claims.is_claimed(intent.source))
             {
-                if (random_action(CARNIVORE_EAT_PROBABILITY))
+                for (uint32_t p = 0; p < intent.num_prey; p++)
                 {
-                    entity_grid[i - 1][j].type = empty;
-                    entity_grid[i - 1][j].age = 0;
-                    entity_grid[i - 1][j].energy = 0;
-                    entity_grid[i][j].energy = entity_grid[i][j].energy + 30;
+                    world.claims.claim(intent.prey[p], claim_rank(k));
                 }
             }
-        }
-        if ((j + 1) < NUM_ROWS)
+        } });
+
+    parallel_for(num_entidades, [](uint64_t begin, uint64_t end)
+                 {
+        for (uint64_t k = begin; k < end; k++)
         {
-            if (entity_grid[i][j + 1].type == herbivore)
+            const intent_t &intent = intencoes[k];
+            if (intent.dies || world.claims.is_claimed(intent.source))
+                continue;
+            with_species(intent.type, [k](auto especie)
+                         { claim_targets<decltype(especie)>(k); });
+        } });
+
+    parallel_for(num_entidades, [](uint64_t begin, uint64_t end)
+                 {
+        for (uint64_t k = begin; k < end; k++)
+        {
+            intent_t &intent = intencoes[k];
+            if (intent.dies || world.claims.is_claimed(intent.source))
             {
-                if (random_action(CARNIVORE_EAT_PROBABILITY))
-                {
-                    entity_grid[i][j + 1].type = empty;
-                    entity_grid[i][j + 1].age = 0;
-                    entity_grid[i][j + 1].energy = 0;
-                    entity_grid[i][j].energy = entity_grid[i][j].energy + 30;
-                }
+                intent.birth_target = NO_CELL;
+                intent.move_target = NO_CELL;
+                continue;
             }
+            with_species(intent.type, [k](auto especie)
+                         { apply_intent<decltype(especie)>(k); });
+        } });
+
+    // tick N+1 becomes current; the old buffer is emptied for the next tick by
+    // clearing the cells that were occupied in it
+    world.swap_buffers();
+    parallel_for(num_entidades, [](uint64_t begin, uint64_t end)
+                 {
+        for (uint64_t k = begin; k < end; k++)
+        {
+            world.next_cells.clear(intencoes[k].source);
+        } });
+    for (const intent_t &intent : intencoes)
+    {
+        world.sync_active(intent.source);
+        if (intent.birth_target != NO_CELL)
+            world.sync_active(intent.birth_target);
+        if (intent.move_target != NO_CELL)
+            world.sync_active(intent.move_target);
+    }
+    world.for_each_plant_word([](uint32_t i, uint32_t w, uint64_t plantas)
+                              { world.plant_ages.finish_sync_tick(i, w, plantas); });
+}
+
+// Points the thread's stream at the draws of the entity in a sparse world
+// cell for the current tick. Cells of a sparse world have no row-major id, so
+// the column is the stream and the row goes in the high word of the tick
+// counter; every cell keeps its own streams for runs of up to 2^32 ticks.
+void start_sparse_cell_stream(const sparse_cell_t &celula)
+{
+    uint64_t contador = (current_tick & UINT32_MAX) | ((uint64_t)(uint32_t)celula.row() << 32);
+    rng.start(simulation_seed, contador, (uint32_t)celula.col());
+}
+
+// Aging pre-pass of one species in one chunk, as age_species() does for the
+// dense world
+template <typename species_t>
+void age_chunk_species(chunk_t &chunk)
+{
+    static thread_local std::vector<sparse_cell_t> celulas;
+    celulas.clear();
+    for (uint32_t li = 0; li < CHUNK_SIZE; li++)
+    {
+        for (uint64_t bits = chunk.boards[species_t::TYPE][li]; bits != 0; bits &= bits - 1)
+        {
+            celulas.push_back({&chunk, chunk.ci, chunk.cj, li, (uint32_t)__builtin_ctzll(bits)});
         }
-        if (j > 0)
+    }
+    age_cells<species_t>(sparse, celulas.data(), (uint32_t)celulas.size());
+}
+
+// Columns of chunk row li run by each phase of the tiled sparse tick
+uint64_t chunk_interior_columns(uint32_t li)
+{
+    // every column but the first and the last
+    return li == 0 || li == CHUNK_SIZE - 1 ? 0 : 0x7FFFFFFFFFFFFFFEull;
+}
+
+uint64_t chunk_ring_columns(uint32_t li)
+{
+    return ~chunk_interior_columns(li);
+}
+
+// Runs, in row-major order, the entities of the chunk in the columns picked
+// by columns(li) that did not act yet. The boards are read again after every
+// entity, so entities eaten or moved away during the tick are skipped.
+template <typename columns_fn_t>
+void simulate_chunk(chunk_t *chunk, columns_fn_t columns)
+{
+    for (uint32_t li = 0; li < CHUNK_SIZE; li++)
+    {
+        uint64_t restantes = columns(li);
+        for (;;)
         {
-            if (entity_grid[i][j - 1].type == herbivore)
-            {
-                if (random_action(CARNIVORE_EAT_PROBABILITY))
-                {
-                    entity_grid[i][j - 1].type = empty;
-                    entity_grid[i][j - 1].age = 0;
-                    entity_grid[i][j - 1].energy = 0;
-                    entity_grid[i][j].energy = entity_grid[i][j].energy + 30;
-                }
-            }
+            uint64_t vivos = chunk->occupied(li) & ~chunk->processed[li] & restantes;
+            if (vivos == 0)
+                break;
+            uint32_t lj = (uint32_t)__builtin_ctzll(vivos);
+            restantes &= ~((2ull << lj) - 1);
+            sparse_cell_t celula = {chunk, chunk->ci, chunk->cj, li, lj};
+            start_sparse_cell_stream(celula);
+            with_species(chunk->type(li, lj), [&celula](auto especie)
+                         { simulate_entity<decltype(especie)>(sparse, celula); });
         }
-        // REPRODUÇÃO
-        if (random_action(CARNIVORE_REPRODUCTION_PROBABILITY) && entity_grid[i][j].energy >= 20)
+    }
+}
+
+// Async tick of the sparse world. Only resident chunks are visited: their
+// processed marks are cleared and their entities aged in parallel, one chunk
+// per batch. With the serial schedule the chunks then run one after the other
+// in row-major order of their coordinates. With the tiled schedule each chunk
+// is a tile: the interior cells, whose neighborhoods never leave the chunk,
+// run in parallel one chunk per worker, and the ring of every chunk, which
+// reaches into the neighboring chunks and may allocate new ones, runs
+// afterwards in chunk order on the calling thread. Chunks left empty are
+// freed at the end of the tick.
+void run_sparse_tick()
+{
+    std::vector<chunk_t *> residentes = sparse.resident();
+    parallel_for(
+        residentes.size(), [&residentes](uint64_t begin, uint64_t end)
         {
-            // analisa casas adjacentes e coloca as disponiveis em um vetor
-            if ((i + 1) < NUM_ROWS)
-            {
-                if (entity_grid[i + 1][j].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i + 1, j));
-                }
-            }
-            if (i > 0)
-            {
-                if (entity_grid[i - 1][j].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i - 1, j));
-                }
-            }
-            if ((j + 1) < NUM_ROWS)
+            for (uint64_t k = begin; k < end; k++)
             {
-                if (entity_grid[i][j + 1].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i, j + 1));
-                }
-            }
-            if (j > 0)
+                chunk_t &chunk = *residentes[k];
+                std::fill(std::begin(chunk.processed), std::end(chunk.processed), 0);
+                age_chunk_species<plant_policy_t>(chunk);
+                age_chunk_species<herbivore_policy_t>(chunk);
+                age_chunk_species<carnivore_policy_t>(chunk);
+            } },
+        1);
+
+    if (async_schedule == tiled_schedule)
+    {
+        parallel_for(
+            residentes.size(), [&residentes](uint64_t begin, uint64_t end)
             {
-                if (entity_grid[i][j - 1].type == empty)
+                for (uint64_t k = begin; k < end; k++)
                 {
-                    posicoes_disponiveis.push_back(std::make_pair(i, j - 1));
-                }
-            }
-            if (!posicoes_disponiveis.empty())
-            {
-                std::uniform_int_distribution<> dis(0, posicoes_disponiveis.size() - 1);
-                int sorteio = dis(gen);
-                int x = posicoes_disponiveis[sorteio].first;
-                int y = posicoes_disponiveis[sorteio].second;
-                std::cout << "sorteio" << sorteio << "\n"
-                          << x << "\n"
-                          << y << "\n";
-                // reproduz
-                entity_grid[x][y].type = carnivore;
-                entity_grid[x][y].energy = 100;
-                entity_grid[x][y].age = 0;
-                // perde energia
-                entity_grid[i][j].energy = entity_grid[i][j].energy - 10;
-                pares_analisados.push_back(std::make_pair(x, y));
-                posicoes_disponiveis.clear();
-            }
+                    simulate_chunk(residentes[k], chunk_interior_columns);
+                } },
+            1);
+        for (chunk_t *chunk : residentes)
+        {
+            simulate_chunk(chunk, chunk_ring_columns);
         }
-        // MOVIMENTAÇÃO
-        if (random_action(CARNIVORE_MOVE_PROBABILITY))
+    }
+    else
+    {
+        for (chunk_t *chunk : residentes)
         {
-            // analisa casas adjacentes e coloca as disponiveis em um vetor
-            if ((i + 1) < NUM_ROWS)
-            {
-                if (entity_grid[i + 1][j].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i + 1, j));
-                }
-            }
-            if (i > 0)
-            {
-                if (entity_grid[i - 1][j].type == empty)
-                {
-                    posicoes_disponiveis.push_back(std::make_pair(i - 1, j));
-                }
-            }
-            if ((j + 1) < NUM_ROWS)
+            simulate_chunk(chunk, [](uint32_t)
+                           { return ~0ull; });
+        }
+    }
+    sparse.release_empty_chunks();
+}
+
+// Async tick of a fixed grid, the serial schedule of run_async_tick() on a
+// grid small enough for a single thread: the occupied cells are taken in
+// row-major order, each species is aged in one batch, and the entities run
+// one after the other
+template <typename grid_t>
+void run_fixed_tick(grid_t &grade)
+{
+    std::array<uint32_t, grid_t::NUM_CELLS> ocupadas;
+    std::array<uint32_t, grid_t::NUM_CELLS> por_especie[4]; // indexed by entity type, [0] unused
+    uint32_t num_ocupadas = 0;
+    uint32_t num_por_especie[4] = {};
+    grade.processed.fill(0);
+    for (uint32_t i = 0; i < grid_t::NUM_ROWS; i++)
+    {
+        for (uint32_t j = 0; j < grid_t::NUM_COLS; j++)
+        {
+            uint32_t c = grade.slot(i, j);
+            entity_type_t tipo = grade.type(c);
+            if (tipo == empty)
+                continue;
+            ocupadas[num_ocupadas++] = c;
+            por_especie[tipo][num_por_especie[tipo]++] = c;
+        }
+    }
+    age_cells<plant_policy_t>(grade, por_especie[plant].data(), num_por_especie[plant]);
+    age_cells<herbivore_policy_t>(grade, por_especie[herbivore].data(), num_por_especie[herbivore]);
+    age_cells<carnivore_policy_t>(grade, por_especie[carnivore].data(), num_por_especie[carnivore]);
+    for (uint32_t k = 0; k < num_ocupadas; k++)
+    {
+        uint32_t c = ocupadas[k];
+        if (grade.processed[c])
+            continue;
+        start_cell_stream(grade.row(c), grade.col(c), grid_t::NUM_COLS, nullptr);
+        with_species(grade.type(c), [&grade, c](auto especie)
+                     { simulate_entity<decltype(especie)>(grade, c); });
+    }
+}
+
+// Advances the simulation by one tick on whichever storage and engine the
+// session runs on
+void run_tick()
+{
+    current_tick++;
+    if (storage == sparse_storage)
+        run_sparse_tick();
+    else if (storage == fixed_storage)
+        with_fixed_grid(view_rows, view_cols, [](auto &grade)
+                        { run_fixed_tick(grade); });
+    else if (update_mode == sync_update)
+        run_sync_tick();
+    else
+        run_async_tick();
+}
+
+// Entities of each type in the whole world, indexed by entity type (the
+// empty count is left at 0); the dense world reads them off its active lists
+// and the sparse one off its bitboards
+std::array<uint64_t, 4> count_entities()
+{
+    std::array<uint64_t, 4> counts = {};
+    if (storage == sparse_storage)
+    {
+        for (const auto &entry : sparse.chunks)
+        {
+            for (entity_type_t type : {plant, herbivore, carnivore})
             {
-                if (entity_grid[i][j + 1].type == empty)
+                for (uint64_t word : entry.second->boards[type])
                 {
-                    posicoes_disponiveis.push_back(std::make_pair(i, j + 1));
+                    counts[type] += __builtin_popcountll(word);
                 }
             }
-            if (j > 0)
+        }
+    }
+    else if (storage == fixed_storage)
+    {
+        with_fixed_grid(view_rows, view_cols, [&counts](const auto &grade)
+                        {
+            for (uint32_t i = 0; i < view_rows; i++)
             {
-                if (entity_grid[i][j - 1].type == empty)
+                for (uint32_t j = 0; j < view_cols; j++)
                 {
-                    posicoes_disponiveis.push_back(std::make_pair(i, j - 1));
+                    counts[grade.type(grade.slot(i, j))]++;
                 }
-            }
-            if (!posicoes_disponiveis.empty())
-            {
-                std::uniform_int_distribution<> dis(0, posicoes_disponiveis.size() - 1);
-                int sorteio = dis(gen);
-                int x = posicoes_disponiveis[sorteio].first;
-                int y = posicoes_disponiveis[sorteio].second;
-                std::cout << "sorteio" << sorteio << "\n"
-                          << x << "\n"
-                          << y << "\n";
-
-                entity_grid[x][y].type = carnivore;
-                entity_grid[x][y].age = entity_grid[i][j].age;
-                entity_grid[x][y].energy = entity_grid[i][j].energy - 5;
-                // limpa a antiga
-                entity_grid[i][j].type = empty;
-                entity_grid[i][j].age = 0;
-                entity_grid[i][j].energy = 0;
-                pares_analisados.push_back(std::make_pair(x, y));
-                posicoes_disponiveis.clear();
-            }
+            } });
+    }
+    else
+    {
+        for (entity_type_t type : {plant, herbivore, carnivore})
+        {
+            counts[type] = world.active.of(type).size();
         }
     }
-    entity_grid[i][j].mtx.unlock();
-    entity_grid[i-1][j].mtx.unlock();
-    entity_grid[i+1][j].mtx.unlock();
-    entity_grid[i][j-1].mtx.unlock();
-    entity_grid[i][j+1].mtx.unlock();
+    counts[empty] = 0;
+    return counts;
 }
 
 int main()
 {
+    // Worker pool used by the parallel schedules, one thread per core unless
+    // ECOSIM_THREADS asks for a different number
+    unsigned num_threads = std::thread::hardware_concurrency();
+    if (const char *threads_env = std::getenv("ECOSIM_THREADS"))
+    {
+        num_threads = (unsigned)std::strtoul(threads_env, nullptr, 10);
+    }
+    start_worker_pool(num_threads);
+
     crow::SimpleApp app;
+    // Crow streams bodies above the threshold 16 KB at a time, copying what
+    // is left of the body on every piece, which is quadratic in the size of a
+    // large grid; they are all handed to the socket in one write instead
+    app.stream_threshold(SIZE_MAX);
 
     // Endpoint to serve the HTML page
     CROW_ROUTE(app, "/")
@@ -527,9 +1336,134 @@ int main()
         // Parse the JSON request body
         nlohmann::json request_body = nlohmann::json::parse(req.body);
 
+        // World size, rows and columns chosen independently
+        uint32_t num_rows = request_body.value("rows", DEFAULT_NUM_ROWS);
+        uint32_t num_cols = request_body.value("cols", DEFAULT_NUM_COLS);
+        if (num_rows == 0 || num_cols == 0 || (uint64_t)num_rows * num_cols > MAXIMUM_NUM_CELLS) {
+        res.code = 400;
+        res.body = "Invalid world size";
+        res.end();
+        return;
+        }
+
+        // Update mode, in place (default) or double buffered
+        std::string modo = request_body.value("mode", "async");
+        update_mode_t modo_escolhido = async_update;
+        if (modo == "async") {
+        modo_escolhido = async_update;
+        } else if (modo == "sync") {
+        modo_escolhido = sync_update;
+        } else {
+        res.code = 400;
+        res.body = "Invalid update mode";
+        res.end();
+        return;
+        }
+
+        // Schedule of the async mode, serial (default) or colored
+        std::string escalonamento = request_body.value("schedule", "serial");
+        async_schedule_t escalonamento_escolhido = serial_schedule;
+        if (escalonamento == "serial") {
+        escalonamento_escolhido = serial_schedule;
+        } else if (escalonamento == "colored") {
+        escalonamento_escolhido = colored_schedule;
+        } else if (escalonamento == "locked") {
+        escalonamento_escolhido = locked_schedule;
+        } else if (escalonamento == "tiled") {
+        escalonamento_escolhido = tiled_schedule;
+        } else {
+        res.code = 400;
+        res.body = "Invalid schedule";
+        res.end();
+        return;
+        }
+
+        // Seed of the run; the same seed and options replay the same simulation
+        uint64_t semente = request_body.contains("seed") ? request_body["seed"].get<uint64_t>()
+                                                         : ((uint64_t)rd() << 32) | rd();
+
+        // Grid edges, closed walls (default) or wrapped around
+        std::string bordas = request_body.value("boundary", "closed");
+        boundary_t bordas_escolhidas = closed_boundary;
+        if (bordas == "closed") {
+        bordas_escolhidas = closed_boundary;
+        } else if (bordas == "toroidal") {
+        bordas_escolhidas = toroidal_boundary;
+        // a cell must not be its own neighbor, or count one twice, and the
+        // color classes must repeat across the seams
+        bool coloracao = modo_escolhido == async_update &&
+                         (escalonamento_escolhido == colored_schedule || escalonamento_escolhido == tiled_schedule);
+        if (num_rows < 3 || num_cols < 3 || (coloracao && (num_rows % NUM_COLORS != 0 || num_cols % NUM_COLORS != 0))) {
+        res.code = 400;
+        res.body = "Invalid world size for a toroidal boundary";
+        res.end();
+        return;
+        }
+        } else {
+        res.code = 400;
+        res.body = "Invalid boundary";
+        res.end();
+        return;
+        }
+
+        // Storage of the cells, one dense grid (default) or sparse chunks;
+        // the sparse world only runs the async update, serially or by tiles,
+        // and has no edges to wrap around
+        std::string armazenamento = request_body.value("storage", "dense");
+        storage_t armazenamento_escolhido = dense_storage;
+        if (armazenamento == "dense") {
+        armazenamento_escolhido = dense_storage;
+        } else if (armazenamento == "sparse") {
+        armazenamento_escolhido = sparse_storage;
+        if (modo_escolhido != async_update || bordas_escolhidas != closed_boundary ||
+            (escalonamento_escolhido != serial_schedule && escalonamento_escolhido != tiled_schedule)) {
+        res.code = 400;
+        res.body = "Options not supported by the sparse storage";
+        res.end();
+        return;
+        }
+        } else {
+        res.code = 400;
+        res.body = "Invalid storage";
+        res.end();
+        return;
+        }
+
+        // Locks of the locked schedule: a mutex (default) or a spinning byte
+        // per cell, or a table of striped spinlocks
+        std::string travamento = request_body.value("locking", "mutex");
+        locking_t travamento_escolhido = mutex_locking;
+        if (travamento == "mutex") {
+        travamento_escolhido = mutex_locking;
+        } else if (travamento == "spin") {
+        travamento_escolhido = spin_locking;
+        } else if (travamento == "striped") {
+        travamento_escolhido = striped_locking;
+        } else {
+        res.code = 400;
+        res.body = "Invalid locking";
+        res.end();
+        return;
+        }
+
+        // Order the entities act in, storage order (default) or shuffled
+        // every tick
+        std::string ordem = request_body.value("order", "storage");
+        update_order_t ordem_escolhida = storage_order;
+        if (ordem == "storage") {
+        ordem_escolhida = storage_order;
+        } else if (ordem == "random" && armazenamento_escolhido == dense_storage) {
+        ordem_escolhida = random_order;
+        } else {
+        res.code = 400;
+        res.body = "Invalid order";
+        res.end();
+        return;
+        }
+
        // Validate the request body 
-        uint32_t total_entinties = (uint32_t)request_body["plants"] + (uint32_t)request_body["herbivores"] + (uint32_t)request_body["carnivores"];
-        if (total_entinties > NUM_ROWS * NUM_ROWS) {
+        uint64_t total_entinties = (uint64_t)request_body["plants"] + (uint64_t)request_body["herbivores"] + (uint64_t)request_body["carnivores"];
+        if (total_entinties > (uint64_t)num_rows * num_cols) {
         res.code = 400;
         res.body = "Too many entities";
         res.end();
@@ -537,47 +1471,91 @@ int main()
         }
 
         // Clear the entity grid
-        entity_grid.clear();
-        entity_grid.assign(NUM_ROWS, std::vector<entity_t>(NUM_ROWS, { empty, 0, 0}));
-        std::uniform_int_distribution<> dis(0, 14);
-        int linha = dis(gen);
-        int coluna = dis(gen);
+        update_mode = modo_escolhido;
+        async_schedule = escalonamento_escolhido;
+        storage = armazenamento_escolhido;
+        update_order = ordem_escolhida;
+        // small sessions of the serial schedule run on a grid sized at compile
+        // time when there is one for their size; it visits the cells in
+        // row-major order, as `world` does unless its layout is blocked
+        if (storage == dense_storage && update_mode == async_update && async_schedule == serial_schedule &&
+            bordas_escolhidas == closed_boundary && update_order == storage_order && cell_layout_t::ROW_MAJOR &&
+            with_fixed_grid(num_rows, num_cols, [](auto &grade) { grade.reset(); }))
+            storage = fixed_storage;
+        view_rows = num_rows;
+        view_cols = num_cols;
+        if (storage == dense_storage) {
+        world.reset(num_rows, num_cols, update_mode == sync_update, bordas_escolhidas);
+        if (update_mode == async_update && async_schedule == locked_schedule)
+            world.locks.reset(travamento_escolhido, world.num_cells());
+        } else {
+        world.reset(0, 0, false);
+        }
+        sparse.reset();
+        simulation_seed = semente;
+        current_tick = 0;
+        rng.start(simulation_seed, 0, PLACEMENT_STREAM);
+        // Empty cell and entity placement on any storage
+        auto livre = [](uint32_t i, uint32_t j) {
+            if (storage == sparse_storage)
+                return sparse.type(sparse.cell(i, j)) == empty;
+            if (storage == fixed_storage) {
+                bool vazia = false;
+                with_fixed_grid(view_rows, view_cols, [&](const auto &grade)
+                                { vazia = grade.type(grade.slot(i, j)) == empty; });
+                return vazia;
+            }
+            return world.type(world.index(i, j)) == empty;
+        };
+        auto coloca = [](uint32_t i, uint32_t j, entity_type_t tipo, int32_t energia) {
+            if (storage == sparse_storage) {
+                sparse_cell_t celula = sparse.cell(i, j);
+                sparse.place(celula, tipo, energia, 0);
+                return;
+            }
+            if (storage == fixed_storage) {
+                with_fixed_grid(view_rows, view_cols, [&](auto &grade)
+                                { grade.place(grade.slot(i, j), tipo, energia, 0); });
+                return;
+            }
+            uint64_t celula = world.index(i, j);
+            world.set_type(celula, tipo);
+            world.set_age(celula, 0);
+            if (tipo != plant)
+                world.set_energy(celula, energia);
+        };
+        uint32_t linha = rng.below(num_rows);
+        uint32_t coluna = rng.below(num_cols);
         // Create the entities
         for(uint32_t i=0;i<(uint32_t)request_body["plants"];i++){
             //cria as planta
-            while (!entity_grid[linha][coluna].type==empty){
-                linha = dis(gen);
-                coluna = dis(gen); 
+            while (!livre(linha, coluna)){
+                linha = rng.below(num_rows);
+                coluna = rng.below(num_cols);
             }
-            entity_grid[linha][coluna].type=plant;
-            entity_grid[linha][coluna].age=0;
+            coloca(linha, coluna, plant, 0);
         }
         for(uint32_t i=0;i<(uint32_t)request_body["herbivores"];i++){
             //cria os coelho
-            while (!entity_grid[linha][coluna].type==empty){
-                linha = dis(gen);
-                coluna = dis(gen); 
+            while (!livre(linha, coluna)){
+                linha = rng.below(num_rows);
+                coluna = rng.below(num_cols);
             }
-            entity_grid[linha][coluna].type=herbivore;
-            entity_grid[linha][coluna].age=0;
-            entity_grid[linha][coluna].energy=100;
-
+            coloca(linha, coluna, herbivore, 100);
         }
         for(uint32_t i=0;i<(uint32_t)request_body["carnivores"];i++){
             //cria os leao
-            while (!entity_grid[linha][coluna].type==empty){
-                linha = dis(gen);
-                coluna = dis(gen); 
+            while (!livre(linha, coluna)){
+                linha = rng.below(num_rows);
+                coluna = rng.below(num_cols);
             }
-            entity_grid[linha][coluna].type=carnivore;
-            entity_grid[linha][coluna].age=0;
-            entity_grid[linha][coluna].energy=100;
+            coloca(linha, coluna, carnivore, 100);
         }
         // <YOUR CODE HERE>
 
         // Return the JSON representation of the entity grid
-        nlohmann::json json_grid = entity_grid; 
-        res.body = json_grid.dump();
+        res.set_header("X-Simulation-Seed", std::to_string(simulation_seed));
+        res.body = world_to_json();
         res.end(); });
 
     // Endpoint to process HTTP GET requests for the next simulation iteration
@@ -588,41 +1566,55 @@ int main()
         // Iterate over the entity grid and simulate the behaviour of each entity
         
         // <YOUR CODE HERE>
-        //Analisa todas as casas
-        bool analisada=false;
-        for(uint32_t i=0;i<NUM_ROWS;i++){
-            for(uint32_t j=0;j<NUM_ROWS;j++){
-                //verifica se a casa ja foi analisada
-                analisada=false;
-                for (int k=0;k<pares_analisados.size();k++){
-                    if (pares_analisados[k].first==i && pares_analisados[k].second==j){
-                        analisada=true;
-                    }
-                }
-                //caso nao tenha sido analisada
-                if (!analisada){
-                    //SE FOR PLANTA
-                    if (entity_grid[i][j].type==plant){
-                        std::thread tplant(simulate_plant,i,j);
-                        tplant.join();
-                    }
-                    //SE FOR COELHO
-                    else if (entity_grid[i][j].type==herbivore){
-                        std::thread therbivore(simulate_herbivore,i,j);
-                        therbivore.join();
-                    }
-                    //SE FOR LEAO
-                    else if (entity_grid[i][j].type==carnivore){
-                        std::thread tcarnivore(simulate_carnivore,i,j);
-                        tcarnivore.join();
-                    }
-                }
-            }
-        }
-        pares_analisados.clear();
+        run_tick();
         // Return the JSON representation of the entity grid
-        nlohmann::json json_grid = entity_grid; 
-        return json_grid.dump(); });
+        return world_to_json(); });
+
+    // Endpoint to run several iterations at once, serializing only the last
+    CROW_ROUTE(app, "/advance")
+        .methods("POST"_method)([](crow::request &req, crow::response &res)
+                                {
+        // Parse the JSON request body; all its fields are optional
+        nlohmann::json request_body = req.body.empty() ? nlohmann::json::object() : nlohmann::json::parse(req.body);
+
+        // Ticks to run, one by default
+        uint64_t passos = request_body.value("steps", (uint64_t)1);
+        if (passos > MAXIMUM_ADVANCE_STEPS) {
+        res.code = 400;
+        res.body = "Invalid number of steps";
+        res.end();
+        return;
+        }
+        // What goes in the response: the grid (default) and the number of
+        // entities of each type; without the grid, only the counts
+        bool contagens = request_body.value("counts", false);
+        bool com_grade = request_body.value("grid", true);
+
+        for (uint64_t passo = 0; passo < passos; passo++)
+            run_tick();
+
+        // Return the JSON representation of the entity grid alone, or an
+        // object with the tick it stands for, the counts and the grid
+        if (com_grade && !contagens) {
+        res.body = world_to_json();
+        res.end();
+        return;
+        }
+        std::array<uint64_t, 4> contagem = count_entities();
+        nlohmann::json resposta;
+        resposta["tick"] = current_tick;
+        resposta["counts"] = {{"plants", contagem[plant]},
+                              {"herbivores", contagem[herbivore]},
+                              {"carnivores", contagem[carnivore]}};
+        res.body = resposta.dump();
+        if (com_grade) {
+        // the grid text goes in as it is, after the other keys
+        res.body.pop_back();
+        res.body += ",\"grid\":";
+        res.body += world_to_json();
+        res.body += '}';
+        }
+        res.end(); });
     app.port(8080).run();
 
     return 0;
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+
+// Packed cell format: one 32-bit word per cell
+//
+//   bits  0..1   entity type
+//   bits  2..9   age (0..255, ages never exceed CARNIVORE_MAXIMUM_AGE)
+//   bits 10..25  energy as a signed 16-bit value (a move can leave it
+//                slightly below zero before the entity starves)
+//   bits 26..31  unused, always zero
+//
+// The helpers below are the only code that knows about this layout.
+typedef uint32_t packed_cell_t;
+
+static const uint32_t PACKED_TYPE_SHIFT = 0;
+static const uint32_t PACKED_TYPE_MASK = 0x3;
+static const uint32_t PACKED_AGE_SHIFT = 2;
+static const uint32_t PACKED_AGE_MASK = 0xff;
+static const uint32_t PACKED_ENERGY_SHIFT = 10;
+static const uint32_t PACKED_ENERGY_MASK = 0xffff;
+
+static const int32_t PACKED_MAXIMUM_AGE = PACKED_AGE_MASK;
+static const int32_t PACKED_MINIMUM_ENERGY = INT16_MIN;
+static const int32_t PACKED_MAXIMUM_ENERGY = INT16_MAX;
+
+inline packed_cell_t pack_type(uint32_t type)
+{
+    return (type & PACKED_TYPE_MASK) << PACKED_TYPE_SHIFT;
+}
+
+inline packed_cell_t pack_age(int32_t age)
+{
+    if (age < 0)
+        age = 0;
+    if (age > PACKED_MAXIMUM_AGE)
+        age = PACKED_MAXIMUM_AGE;
+    return ((uint32_t)age & PACKED_AGE_MASK) << PACKED_AGE_SHIFT;
+}
+
+inline packed_cell_t pack_energy(int32_t energy)
+{
+    if (energy < PACKED_MINIMUM_ENERGY)
+        energy = PACKED_MINIMUM_ENERGY;
+    if (energy > PACKED_MAXIMUM_ENERGY)
+        energy = PACKED_MAXIMUM_ENERGY;
+    return ((uint32_t)(uint16_t)(int16_t)energy & PACKED_ENERGY_MASK) << PACKED_ENERGY_SHIFT;
+}
+
+inline packed_cell_t pack_cell(uint32_t type, int32_t energy, int32_t age)
+{
+    return pack_type(type) | pack_age(age) | pack_energy(energy);
+}
+
+inline uint32_t unpack_type(packed_cell_t cell)
+{
+    return (cell >> PACKED_TYPE_SHIFT) & PACKED_TYPE_MASK;
+}
+
+inline int32_t unpack_age(packed_cell_t cell)
+{
+    return (int32_t)((cell >> PACKED_AGE_SHIFT) & PACKED_AGE_MASK);
+}
+
+inline int32_t unpack_energy(packed_cell_t cell)
+{
+    return (int32_t)(int16_t)(uint16_t)((cell >> PACKED_ENERGY_SHIFT) & PACKED_ENERGY_MASK);
+}
+
+// Field replacement keeping the other two fields untouched
+inline packed_cell_t repack_type(packed_cell_t cell, uint32_t type)
+{
+    return (cell & ~(PACKED_TYPE_MASK << PACKED_TYPE_SHIFT)) | pack_type(type);
+}
+
+inline packed_cell_t repack_age(packed_cell_t cell, int32_t age)
+{
+    return (cell & ~(PACKED_AGE_MASK << PACKED_AGE_SHIFT)) | pack_age(age);
+}
+
+inline packed_cell_t repack_energy(packed_cell_t cell, int32_t energy)
+{
+    return (cell & ~(PACKED_ENERGY_MASK << PACKED_ENERGY_SHIFT)) | pack_energy(energy);
+}
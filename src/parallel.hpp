@@ -0,0 +1,46 @@
+#pragma once
+
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+
+// Pool shared by every parallel region, started once at server boot
+inline std::unique_ptr<thread_pool_t> &worker_pool()
+{
+    static std::unique_ptr<thread_pool_t> pool;
+    return pool;
+}
+
+inline void start_worker_pool(unsigned num_threads)
+{
+    worker_pool().reset(new thread_pool_t(num_threads));
+}
+
+inline unsigned num_workers()
+{
+    return worker_pool() ? worker_pool()->size() : 1;
+}
+
+// Batches handed to the pool never get smaller than this many items
+static const uint64_t MINIMUM_BATCH = 64;
+
+// Runs fn(begin, end) over [0, count) on the worker pool, in batches of
+// consecutive items, and returns once every batch is done. Runs inline when
+// there is no pool, when the range is too small to split or when called from
+// inside another parallel region. Coarse items (tiles, rows) can lower
+// min_batch down to 1.
+template <typename fn_t>
+void parallel_for(uint64_t count, fn_t fn, uint64_t min_batch = MINIMUM_BATCH)
+{
+    unsigned workers = num_workers();
+    if (workers == 1 || count <= min_batch || thread_pool_t::in_job())
+    {
+        if (count > 0)
+            fn((uint64_t)0, count);
+        return;
+    }
+    // a few batches per worker so that faster workers can pick up the slack
+    uint64_t batch = std::max(min_batch, count / ((uint64_t)workers * 4));
+    worker_pool()->run(count, batch, fn);
+}
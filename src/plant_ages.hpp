@@ -0,0 +1,104 @@
+#pragma once
+
+#include "bitboard.hpp"
+#include <cstdint>
+
+// Plant ages stored bit-sliced: bit k of the age of cell (i, j) is bit (i, j)
+// of planes[k]. Four planes hold ages 0 to 15, and a whole row word of plants
+// (64 cells) is aged or tested against the maximum age with a handful of word
+// operations, without ever looking at the cells one by one. The planes are the
+// only record of plant ages; cells that hold no plant keep all their bits zero,
+// so a plant is born with age 0.
+//
+// The tick passes return the plants that reached the maximum age at the start
+// of the tick; the caller marks them as dying, and they are removed when their
+// turn comes, as if they had aged one by one.
+struct plant_ages_t
+{
+    static const uint32_t NUM_PLANES = 4;
+    static const int32_t MAXIMUM_STORED_AGE = (1 << NUM_PLANES) - 1;
+
+    bitboard_t planes[NUM_PLANES];
+    bitboard_t previous; // plants at the start of a synchronous tick
+
+    void reset(uint32_t rows, uint32_t cols)
+    {
+        for (bitboard_t &plane : planes)
+        {
+            plane.reset(rows, cols);
+        }
+        previous.reset(rows, cols);
+    }
+
+    int32_t age(uint32_t i, uint32_t j) const
+    {
+        int32_t age_value = 0;
+        for (uint32_t k = 0; k < NUM_PLANES; k++)
+        {
+            age_value |= (int32_t)planes[k].test(i, j) << k;
+        }
+        return age_value;
+    }
+
+    // Forgets the plant of the cell
+    void clear(uint32_t i, uint32_t j)
+    {
+        for (bitboard_t &plane : planes)
+        {
+            plane.unset(i, j);
+        }
+    }
+
+    // Cells of row word (i, w) whose age is exactly `age`
+    uint64_t age_equals(uint32_t i, uint32_t w, int32_t age) const
+    {
+        uint64_t equal = ~0ull;
+        for (uint32_t k = 0; k < NUM_PLANES; k++)
+        {
+            uint64_t plane_word = planes[k].word(i, w);
+            equal &= ((age >> k) & 1) ? plane_word : ~plane_word;
+        }
+        return equal;
+    }
+
+    // Adds one to the age of the cells of row word (i, w) set in `mask` and
+    // zeroes the age of the cells set in `zero` (ripple-carry over the planes)
+    void increment(uint32_t i, uint32_t w, uint64_t mask, uint64_t zero = 0)
+    {
+        uint64_t carry = mask;
+        for (bitboard_t &plane : planes)
+        {
+            uint64_t plane_word = plane.word(i, w);
+            plane.store(i, w, (plane_word ^ carry) & ~zero);
+            carry &= plane_word;
+        }
+    }
+
+    // Start of an async tick for the plants `plants` of row word (i, w): the
+    // ones at the maximum age are returned as dying, all the others grow one
+    // year older
+    uint64_t start_async_tick(uint32_t i, uint32_t w, uint64_t plants, int32_t maximum_age)
+    {
+        uint64_t reaching_max = plants & age_equals(i, w, maximum_age);
+        increment(i, w, plants & ~reaching_max);
+        return reaching_max;
+    }
+
+    // Start of a sync tick: returns the dying plants and remembers which cells
+    // hold a plant, for finish_sync_tick()
+    uint64_t start_sync_tick(uint32_t i, uint32_t w, uint64_t plants, int32_t maximum_age)
+    {
+        previous.store(i, w, plants);
+        return plants & age_equals(i, w, maximum_age);
+    }
+
+    // End of a sync tick, `plants` being the plants of tick N+1: plants never
+    // move and are only born on empty cells, so the ones that were already
+    // there are the survivors and grow older, and every other cell (newborn
+    // plants included) starts from zero
+    void finish_sync_tick(uint32_t i, uint32_t w, uint64_t plants)
+    {
+        uint64_t survivors = plants & previous.word(i, w);
+        increment(i, w, survivors, ~survivors);
+    }
+};
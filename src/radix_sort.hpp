@@ -0,0 +1,67 @@
+#pragma once
+
+#include "parallel.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Stable LSD radix sort of 64-bit values by their bits [first_bit, 64), eight
+// bits per pass; lower bits only break ties by keeping the input order. Each
+// pass splits the values in fixed blocks: every block counts its digits in
+// parallel, a prefix sum in (digit, block) order gives each block where its
+// values of every digit go, and the blocks scatter in parallel. The sort is
+// stable, so the result does not depend on the number of blocks or workers.
+inline void parallel_radix_sort(std::vector<uint64_t> &values, std::vector<uint64_t> &scratch, uint32_t first_bit = 0)
+{
+    static const uint32_t DIGIT_BITS = 8;
+    static const uint32_t NUM_DIGITS = 1u << DIGIT_BITS;
+    // fewer values than this per block are not worth a histogram of their own
+    static const uint64_t MINIMUM_BLOCK = 4096;
+
+    uint64_t count = values.size();
+    scratch.resize(count);
+    uint64_t num_blocks = std::max<uint64_t>(1, std::min<uint64_t>((uint64_t)num_workers() * 4, count / MINIMUM_BLOCK));
+    std::vector<uint64_t> offsets(num_blocks * NUM_DIGITS);
+    auto block_begin = [count, num_blocks](uint64_t b)
+    { return count * b / num_blocks; };
+
+    for (uint32_t shift = first_bit; shift < 64; shift += DIGIT_BITS)
+    {
+        parallel_for(
+            num_blocks, [&](uint64_t begin, uint64_t end)
+            {
+                for (uint64_t b = begin; b < end; b++)
+                {
+                    uint64_t *histogram = &offsets[b * NUM_DIGITS];
+                    std::fill(histogram, histogram + NUM_DIGITS, 0);
+                    for (uint64_t k = block_begin(b); k < block_begin(b + 1); k++)
+                    {
+                        histogram[(values[k] >> shift) & (NUM_DIGITS - 1)]++;
+                    }
+                } },
+            1);
+        uint64_t total = 0;
+        for (uint32_t d = 0; d < NUM_DIGITS; d++)
+        {
+            for (uint64_t b = 0; b < num_blocks; b++)
+            {
+                uint64_t digits = offsets[b * NUM_DIGITS + d];
+                offsets[b * NUM_DIGITS + d] = total;
+                total += digits;
+            }
+        }
+        parallel_for(
+            num_blocks, [&](uint64_t begin, uint64_t end)
+            {
+                for (uint64_t b = begin; b < end; b++)
+                {
+                    uint64_t *next = &offsets[b * NUM_DIGITS];
+                    for (uint64_t k = block_begin(b); k < block_begin(b + 1); k++)
+                    {
+                        scratch[next[(values[k] >> shift) & (NUM_DIGITS - 1)]++] = values[k];
+                    }
+                } },
+            1);
+        values.swap(scratch);
+    }
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include "world.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Side of the square chunks of a sparse world; a chunk row is one 64-bit word
+static const uint32_t CHUNK_SIZE = 64;
+static const uint32_t CHUNK_CELLS = CHUNK_SIZE * CHUNK_SIZE;
+
+// Block of CHUNK_SIZE x CHUNK_SIZE cells of a sparse world. Chunk (ci, cj)
+// holds rows 64ci .. 64ci + 63 and columns 64cj .. 64cj + 63. Types are kept
+// only as one bitboard row word per species and chunk row; `dying` and
+// `processed` play the same role as in world_t.
+struct chunk_t
+{
+    int32_t ci = 0;
+    int32_t cj = 0;
+    uint64_t boards[4][CHUNK_SIZE]; // indexed by entity type, boards[0] unused
+    uint64_t dying[CHUNK_SIZE];
+    uint64_t processed[CHUNK_SIZE];
+    int32_t energies[CHUNK_CELLS];
+    int32_t ages[CHUNK_CELLS];
+    uint32_t population = 0;
+    chunk_t *neighbors[NUM_NEIGHBORS]; // resident chunks around, nullptr if none
+
+    chunk_t() : boards(), dying(), processed(), energies(), ages(), neighbors() {}
+
+    uint64_t occupied(uint32_t li) const
+    {
+        return boards[plant][li] | boards[herbivore][li] | boards[carnivore][li];
+    }
+
+    entity_type_t type(uint32_t li, uint32_t lj) const
+    {
+        for (entity_type_t type : {plant, herbivore, carnivore})
+        {
+            if ((boards[type][li] >> lj) & 1)
+                return type;
+        }
+        return empty;
+    }
+};
+
+// Cell of a sparse world, with the chunk it falls in (nullptr while that chunk
+// is not resident)
+struct sparse_cell_t
+{
+    chunk_t *chunk;
+    int32_t ci;
+    int32_t cj;
+    uint32_t li;
+    uint32_t lj;
+
+    int64_t row() const { return (int64_t)ci * CHUNK_SIZE + li; }
+    int64_t col() const { return (int64_t)cj * CHUNK_SIZE + lj; }
+    uint32_t local() const { return li * CHUNK_SIZE + lj; }
+};
+
+// World without edges, stored as chunks held in a hash map. A chunk is
+// allocated when the first entity enters it and freed by release_empty_chunks()
+// once it holds none, so memory and tick work follow the population instead of
+// the area the entities are spread over. Every resident chunk keeps pointers
+// to its resident neighbors, which lets neighbor lookups step across chunk
+// borders without going through the map.
+//
+// Unlike world_t the chunks are not shared between workers: parallel code may
+// only change cells of one chunk per worker, and only the cells whose
+// neighbors lie in the same chunk (see run_sparse_tick()).
+struct sparse_world_t
+{
+    std::unordered_map<uint64_t, std::unique_ptr<chunk_t>> chunks;
+
+    void reset()
+    {
+        chunks.clear();
+    }
+
+    static uint64_t key(int32_t ci, int32_t cj)
+    {
+        return ((uint64_t)(uint32_t)ci << 32) | (uint32_t)cj;
+    }
+
+    chunk_t *find(int32_t ci, int32_t cj) const
+    {
+        auto it = chunks.find(key(ci, cj));
+        return it == chunks.end() ? nullptr : it->second.get();
+    }
+
+    sparse_cell_t cell(int64_t row, int64_t col) const
+    {
+        int32_t ci = (int32_t)floor_div(row);
+        int32_t cj = (int32_t)floor_div(col);
+        return {find(ci, cj), ci, cj,
+                (uint32_t)(row - (int64_t)ci * CHUNK_SIZE), (uint32_t)(col - (int64_t)cj * CHUNK_SIZE)};
+    }
+
+    entity_type_t type(const sparse_cell_t &c) const
+    {
+        return c.chunk ? c.chunk->type(c.li, c.lj) : empty;
+    }
+
+    int32_t energy(const sparse_cell_t &c) const { return c.chunk->energies[c.local()]; }
+    int32_t age(const sparse_cell_t &c) const { return c.chunk->ages[c.local()]; }
+    void set_energy(const sparse_cell_t &c, int32_t energy) { c.chunk->energies[c.local()] = energy; }
+    void set_age(const sparse_cell_t &c, int32_t age) { c.chunk->ages[c.local()] = age; }
+
+    entity_t entity(const sparse_cell_t &c) const
+    {
+        entity_type_t type = this->type(c);
+        if (type == empty)
+            return {empty, 0, 0};
+        return {type, energy(c), age(c)};
+    }
+
+    bool is_dying(const sparse_cell_t &c) const
+    {
+        return (c.chunk->dying[c.li] >> c.lj) & 1;
+    }
+
+    void mark_dying(const sparse_cell_t &c)
+    {
+        c.chunk->dying[c.li] |= 1ull << c.lj;
+    }
+
+    bool is_processed(const sparse_cell_t &c) const
+    {
+        return (c.chunk->processed[c.li] >> c.lj) & 1;
+    }
+
+    void mark_processed(const sparse_cell_t &c)
+    {
+        c.chunk->processed[c.li] |= 1ull << c.lj;
+    }
+
+    // Puts an entity in the cell, replacing whatever was there; the chunk is
+    // allocated first if it is not resident
+    void place(sparse_cell_t &c, entity_type_t type, int32_t energy, int32_t age)
+    {
+        if (!c.chunk)
+            c.chunk = allocate(c.ci, c.cj);
+        chunk_t &chunk = *c.chunk;
+        uint64_t bit = 1ull << c.lj;
+        if (chunk.occupied(c.li) & bit)
+            unset_bits(chunk, c.li, bit);
+        else
+            chunk.population++;
+        chunk.boards[type][c.li] |= bit;
+        chunk.energies[c.local()] = energy;
+        chunk.ages[c.local()] = age;
+    }
+
+    // Empties the cell
+    void clear(const sparse_cell_t &c)
+    {
+        if (!c.chunk)
+            return;
+        chunk_t &chunk = *c.chunk;
+        uint64_t bit = 1ull << c.lj;
+        if (!(chunk.occupied(c.li) & bit))
+            return;
+        unset_bits(chunk, c.li, bit);
+        chunk.energies[c.local()] = 0;
+        chunk.ages[c.local()] = 0;
+        chunk.population--;
+    }
+
+    // Neighbor of the cell in the direction; there is always one
+    sparse_cell_t neighbor(const sparse_cell_t &c, uint32_t direction) const
+    {
+        int32_t li = (int32_t)c.li + NEIGHBOR_ROW_STEPS[direction];
+        int32_t lj = (int32_t)c.lj + NEIGHBOR_COL_STEPS[direction];
+        sparse_cell_t n = c;
+        n.li = (uint32_t)li % CHUNK_SIZE;
+        n.lj = (uint32_t)lj % CHUNK_SIZE;
+        if (n.li == (uint32_t)li && n.lj == (uint32_t)lj)
+            return n;
+        n.ci += NEIGHBOR_ROW_STEPS[direction];
+        n.cj += NEIGHBOR_COL_STEPS[direction];
+        n.chunk = c.chunk ? c.chunk->neighbors[direction] : find(n.ci, n.cj);
+        return n;
+    }
+
+    // 4-bit mask (bit d for neighbor_direction_t d) of the neighbors of the
+    // cell holding the type
+    uint32_t neighbor_mask(entity_type_t type, const sparse_cell_t &c) const
+    {
+        uint32_t mask = 0;
+        for (uint32_t d = 0; d < NUM_NEIGHBORS; d++)
+        {
+            mask |= (uint32_t)(this->type(neighbor(c, d)) == type) << d;
+        }
+        return mask;
+    }
+
+    // Resident chunks in row-major order of their coordinates
+    std::vector<chunk_t *> resident() const
+    {
+        std::vector<chunk_t *> list;
+        list.reserve(chunks.size());
+        for (const auto &entry : chunks)
+        {
+            list.push_back(entry.second.get());
+        }
+        std::sort(list.begin(), list.end(), [](const chunk_t *a, const chunk_t *b)
+                  { return a->ci != b->ci ? a->ci < b->ci : a->cj < b->cj; });
+        return list;
+    }
+
+    // Frees the chunks left without entities
+    void release_empty_chunks()
+    {
+        for (auto it = chunks.begin(); it != chunks.end();)
+        {
+            chunk_t &chunk = *it->second;
+            if (chunk.population != 0)
+            {
+                ++it;
+                continue;
+            }
+            for (uint32_t d = 0; d < NUM_NEIGHBORS; d++)
+            {
+                if (chunk.neighbors[d])
+                    chunk.neighbors[d]->neighbors[opposite(d)] = nullptr;
+            }
+            it = chunks.erase(it);
+        }
+    }
+
+private:
+    static int64_t floor_div(int64_t x)
+    {
+        return x >= 0 ? x / CHUNK_SIZE : -((-x + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    }
+
+    // Down and up, right and left are consecutive in neighbor_direction_t
+    static uint32_t opposite(uint32_t direction)
+    {
+        return direction ^ 1;
+    }
+
+    static void unset_bits(chunk_t &chunk, uint32_t li, uint64_t bit)
+    {
+        for (entity_type_t type : {plant, herbivore, carnivore})
+        {
+            chunk.boards[type][li] &= ~bit;
+        }
+        chunk.dying[li] &= ~bit;
+    }
+
+    chunk_t *allocate(int32_t ci, int32_t cj)
+    {
+        std::unique_ptr<chunk_t> &slot = chunks[key(ci, cj)];
+        slot.reset(new chunk_t());
+        chunk_t *chunk = slot.get();
+        chunk->ci = ci;
+        chunk->cj = cj;
+        for (uint32_t d = 0; d < NUM_NEIGHBORS; d++)
+        {
+            chunk_t *other = find(ci + NEIGHBOR_ROW_STEPS[d], cj + NEIGHBOR_COL_STEPS[d]);
+            chunk->neighbors[d] = other;
+            if (other)
+                other->neighbors[opposite(d)] = chunk;
+        }
+        return chunk;
+    }
+};
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Index of the worker running the calling thread, 0 outside parallel regions.
+// Lets shared structures keep one slot per worker instead of locking.
+inline unsigned &current_worker()
+{
+    static thread_local unsigned index = 0;
+    return index;
+}
+
+// Long-lived pool of worker threads. A job is a range of items split in
+// batches. Every worker (the thread that submitted the job is worker 0) gets
+// its own queue holding a contiguous share of the batches, which it runs front
+// to back. A worker whose queue runs dry steals from the back of the other
+// queues, so dense regions of the world do not leave the other cores idle.
+// run() returns only when every queue is drained and every worker is done with
+// the job, which makes it a barrier.
+class thread_pool_t
+{
+public:
+    typedef std::function<void(uint64_t, uint64_t)> job_t;
+
+    explicit thread_pool_t(unsigned num_workers)
+        : num_workers_(std::max(1u, num_workers))
+    {
+        for (unsigned w = 0; w < num_workers_; w++)
+        {
+            queues_.emplace_back(new work_queue_t());
+        }
+        for (unsigned w = 1; w < num_workers_; w++)
+        {
+            threads_.emplace_back(&thread_pool_t::worker_loop, this, w);
+        }
+    }
+
+    ~thread_pool_t()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread &t : threads_)
+        {
+            t.join();
+        }
+    }
+
+    thread_pool_t(const thread_pool_t &) = delete;
+    thread_pool_t &operator=(const thread_pool_t &) = delete;
+
+    unsigned size() const
+    {
+        return num_workers_;
+    }
+
+    // True on a thread that is currently running a batch
+    static bool in_job()
+    {
+        return running_batch();
+    }
+
+    // Runs job(begin, end) over [0, count) in batches of at most `batch` items
+    void run(uint64_t count, uint64_t batch, const job_t &job)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            job_ = &job;
+            batch = std::max<uint64_t>(1, batch);
+            uint64_t num_batches = (count + batch - 1) / batch;
+            for (unsigned w = 0; w < num_workers_; w++)
+            {
+                work_queue_t &queue = *queues_[w];
+                std::lock_guard<std::mutex> queue_guard(queue.mutex);
+                queue.batches.clear();
+                uint64_t first = num_batches * w / num_workers_;
+                uint64_t last = num_batches * (w + 1) / num_workers_;
+                for (uint64_t b = first; b < last; b++)
+                {
+                    queue.batches.push_back({b * batch, std::min(count, (b + 1) * batch)});
+                }
+                queue.head = 0;
+            }
+            busy_ = num_workers_ - 1;
+            generation_++;
+        }
+        wake_.notify_all();
+
+        unsigned caller = current_worker();
+        current_worker() = 0;
+        work(0);
+        current_worker() = caller;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]()
+                   { return busy_ == 0; });
+        job_ = nullptr;
+    }
+
+private:
+    struct batch_t
+    {
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    // Batches still to run are batches[head, size()): the owner takes from the
+    // front, thieves from the back
+    struct work_queue_t
+    {
+        std::mutex mutex;
+        std::vector<batch_t> batches;
+        size_t head = 0;
+    };
+
+    static bool &running_batch()
+    {
+        static thread_local bool running = false;
+        return running;
+    }
+
+    bool pop_own(unsigned worker, batch_t &batch)
+    {
+        work_queue_t &queue = *queues_[worker];
+        std::lock_guard<std::mutex> guard(queue.mutex);
+        if (queue.head == queue.batches.size())
+            return false;
+        batch = queue.batches[queue.head++];
+        return true;
+    }
+
+    bool steal(unsigned thief, batch_t &batch)
+    {
+        for (unsigned k = 1; k < num_workers_; k++)
+        {
+            work_queue_t &queue = *queues_[(thief + k) % num_workers_];
+            std::lock_guard<std::mutex> guard(queue.mutex);
+            if (queue.head == queue.batches.size())
+                continue;
+            batch = queue.batches.back();
+            queue.batches.pop_back();
+            return true;
+        }
+        return false;
+    }
+
+    // No job pushes new batches, so once every queue is empty the worker is done
+    void work(unsigned worker)
+    {
+        running_batch() = true;
+        batch_t batch;
+        while (pop_own(worker, batch) || steal(worker, batch))
+        {
+            (*job_)(batch.begin, batch.end);
+        }
+        running_batch() = false;
+    }
+
+    void worker_loop(unsigned index)
+    {
+        current_worker() = index;
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;)
+        {
+            wake_.wait(lock, [this, &seen]()
+                       { return stopping_ || generation_ != seen; });
+            if (stopping_)
+                return;
+            seen = generation_;
+            lock.unlock();
+            work(index);
+            lock.lock();
+            if (--busy_ == 0)
+                done_.notify_one();
+        }
+    }
+
+    unsigned num_workers_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    bool stopping_ = false;
+    uint64_t generation_ = 0;
+    unsigned busy_ = 0;
+
+    // current job, published under mutex_ before generation_ changes
+    const job_t *job_ = nullptr;
+    std::vector<std::unique_ptr<work_queue_t>> queues_;
+};
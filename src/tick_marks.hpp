@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Per-cell "already processed in this tick" marks. Instead of clearing a flag on
+// every cell after each tick, each cell stores the tick epoch in which it was
+// last marked, so marking and testing are O(1) and moving to the next tick only
+// bumps the epoch. The stamps are only wiped when the 32-bit epoch wraps around,
+// and that wipe can be split in ranges across workers with clear().
+struct tick_marks_t
+{
+    std::vector<uint32_t> stamps;
+    uint32_t epoch = 1;
+
+    void reset(uint64_t num_cells)
+    {
+        stamps.assign(num_cells, 0);
+        epoch = 1;
+    }
+
+    // Starts a new tick. Returns true when the epoch wrapped and the stamps must
+    // be wiped with clear() before the tick starts marking cells.
+    bool advance()
+    {
+        epoch++;
+        if (epoch == 0)
+        {
+            epoch = 1;
+            return true;
+        }
+        return false;
+    }
+
+    void clear(uint64_t begin, uint64_t end)
+    {
+        std::fill(stamps.begin() + begin, stamps.begin() + end, 0);
+    }
+
+    void mark(uint64_t idx)
+    {
+        stamps[idx] = epoch;
+    }
+
+    bool is_marked(uint64_t idx) const
+    {
+        return stamps[idx] == epoch;
+    }
+};
@@ -0,0 +1,448 @@
+#pragma once
+
+#include "active_set.hpp"
+#include "bitboard.hpp"
+#include "cell_layout.hpp"
+#include "cell_locks.hpp"
+#include "claims.hpp"
+#include "packed_cell.hpp"
+#include "parallel.hpp"
+#include "plant_ages.hpp"
+#include "tick_marks.hpp"
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Type definitions
+enum entity_type_t : uint8_t
+{
+    empty,
+    plant,
+    herbivore,
+    carnivore
+};
+
+// What lies past the edges of the grid
+//  - closed_boundary: nothing, edge cells simply have fewer neighbors
+//  - toroidal_boundary: the grid wraps around, the cells of the last row are
+//    neighbors of the cells of the first one, and likewise for columns
+enum boundary_t
+{
+    closed_boundary,
+    toroidal_boundary
+};
+
+// Value snapshot of one cell, used when a whole entity has to be handed around
+// (JSON serialization, for instance)
+struct entity_t
+{
+    entity_type_t type;
+    int32_t energy;
+    int32_t age;
+};
+
+// Cell of the world as the entity kernels address it: its position, for the
+// neighbor queries, and its storage index
+struct world_cell_t
+{
+    uint32_t i;
+    uint32_t j;
+    uint64_t idx;
+};
+
+// Storage for the state of every cell.
+//
+// Cells are stored as a structure of arrays: a sweep that only looks at the
+// entity types touches one byte per cell. Building with ECOSIM_PACKED_CELLS
+// stores each cell as a single packed 32-bit word instead (see packed_cell.hpp),
+// which cuts the cell data from 9 to 4 bytes.
+struct cell_buffer_t
+{
+#ifdef ECOSIM_PACKED_CELLS
+    std::vector<packed_cell_t> cells;
+
+    void reset(uint64_t num_cells)
+    {
+        cells.assign(num_cells, pack_cell(empty, 0, 0));
+    }
+
+    void release()
+    {
+        std::vector<packed_cell_t>().swap(cells);
+    }
+
+    bool allocated() const { return !cells.empty(); }
+
+    entity_type_t type(uint64_t idx) const { return (entity_type_t)unpack_type(cells[idx]); }
+    int32_t energy(uint64_t idx) const { return unpack_energy(cells[idx]); }
+    int32_t age(uint64_t idx) const { return unpack_age(cells[idx]); }
+
+    void set_type(uint64_t idx, entity_type_t type) { cells[idx] = repack_type(cells[idx], type); }
+    void set_energy(uint64_t idx, int32_t energy) { cells[idx] = repack_energy(cells[idx], energy); }
+    void set_age(uint64_t idx, int32_t age) { cells[idx] = repack_age(cells[idx], age); }
+
+    void set(uint64_t idx, entity_type_t type, int32_t energy, int32_t age)
+    {
+        cells[idx] = pack_cell(type, energy, age);
+    }
+
+    entity_t entity(uint64_t idx) const
+    {
+        packed_cell_t cell = cells[idx];
+        return {(entity_type_t)unpack_type(cell), unpack_energy(cell), unpack_age(cell)};
+    }
+
+    void clear(uint64_t idx)
+    {
+        cells[idx] = pack_cell(empty, 0, 0);
+    }
+#else
+    std::vector<entity_type_t> types;
+    std::vector<int32_t> energies;
+    std::vector<int32_t> ages;
+
+    void reset(uint64_t num_cells)
+    {
+        types.assign(num_cells, empty);
+        energies.assign(num_cells, 0);
+        ages.assign(num_cells, 0);
+    }
+
+    void release()
+    {
+        std::vector<entity_type_t>().swap(types);
+        std::vector<int32_t>().swap(energies);
+        std::vector<int32_t>().swap(ages);
+    }
+
+    bool allocated() const { return !types.empty(); }
+
+    entity_type_t type(uint64_t idx) const { return types[idx]; }
+    int32_t energy(uint64_t idx) const { return energies[idx]; }
+    int32_t age(uint64_t idx) const { return ages[idx]; }
+
+    void set_type(uint64_t idx, entity_type_t type) { types[idx] = type; }
+    void set_energy(uint64_t idx, int32_t energy) { energies[idx] = energy; }
+    void set_age(uint64_t idx, int32_t age) { ages[idx] = age; }
+
+    void set(uint64_t idx, entity_type_t type, int32_t energy, int32_t age)
+    {
+        types[idx] = type;
+        energies[idx] = energy;
+        ages[idx] = age;
+    }
+
+    entity_t entity(uint64_t idx) const
+    {
+        return {types[idx], energies[idx], ages[idx]};
+    }
+
+    void clear(uint64_t idx)
+    {
+        types[idx] = empty;
+        energies[idx] = 0;
+        ages[idx] = 0;
+    }
+#endif
+};
+
+// Grid that contains the entities. The world size is chosen at runtime and all
+// the cells live in one array addressed by 64-bit indices, so neighbor accesses
+// never chase a per-row pointer; `layout` maps positions to indices (row-major,
+// or blocks in Z-order, see cell_layout.hpp). The locks of the locked schedule
+// live in their own layer (`locks`, see cell_locks.hpp), never sharing cache
+// lines with the cell data, and are only allocated when that schedule runs.
+//
+// Every change of entity type goes through set_type() or clear(), which keep the
+// per-species active lists and occupancy bitboards up to date on birth, death
+// and move. The bitboards answer neighbor queries for 64 cells of a row at a
+// time (neighbor_words()) and are updated right away, even in the parallel
+// schedules, with atomic word updates. Their halo makes the boundary, closed
+// or toroidal, invisible to the neighbor queries. Plant ages live bit-sliced in
+// `plant_ages` instead of in the cells. Entities that reach the end of their
+// life at the start of a tick are flagged in `dying` and removed on their turn.
+// Cells that received an entity during the current tick are marked in
+// `processed` so the entity does not act twice.
+//
+// While `defer_active` is set (parallel schedules) the active list updates are
+// only logged, one log per worker, and flush_active() applies them once the
+// workers are done.
+//
+// Worlds reset as double buffered also own `next_cells`, which the synchronous
+// update mode fills with tick N+1 while reading tick N from `cells`, and the
+// `claims` board it arbitrates conflicting intents with. Writes to `next_cells`
+// bypass the active lists; sync_active() brings them up to date after
+// swap_buffers().
+struct world_t
+{
+    uint32_t num_rows = 0;
+    uint32_t num_cols = 0;
+    cell_layout_t layout;
+    cell_buffer_t cells;
+    cell_buffer_t next_cells;
+    claim_board_t claims;
+    cell_locks_t locks;
+    active_sets_t active;
+    bitboard_t boards[4]; // indexed by entity type, boards[0] unused
+    bitboard_t inside;    // cells of the grid, halo mirrors included
+    uint64_t last_word_mask = 0; // columns of the last word of a row inside the grid
+    boundary_t boundary = closed_boundary;
+    plant_ages_t plant_ages;
+    bitboard_t dying;
+    tick_marks_t processed;
+    bool defer_active = false;
+    std::vector<std::vector<uint64_t>> pending_active;
+
+    void reset(uint32_t rows, uint32_t cols, bool double_buffered, boundary_t edges = closed_boundary)
+    {
+        num_rows = rows;
+        num_cols = cols;
+        layout.reset(rows, cols);
+        boundary = edges;
+        cells.reset(num_cells());
+        if (double_buffered)
+        {
+            next_cells.reset(num_cells());
+            claims.reset(num_cells());
+        }
+        else
+        {
+            next_cells.release();
+            claims.release();
+        }
+        locks.release();
+        active.reset(num_cells());
+        for (entity_type_t type : {plant, herbivore, carnivore})
+        {
+            boards[type].reset(rows, cols, boundary == toroidal_boundary);
+        }
+        inside.reset(rows, cols, boundary == toroidal_boundary);
+        inside.fill();
+        last_word_mask = cols % 64 == 0 ? ~0ull : (1ull << (cols % 64)) - 1;
+        plant_ages.reset(rows, cols);
+        dying.reset(rows, cols);
+        processed.reset(num_cells());
+        pending_active.assign(num_workers(), std::vector<uint64_t>());
+    }
+
+    // Cells of the storage, the padding of the blocked layout included
+    uint64_t num_cells() const
+    {
+        return layout.num_cells();
+    }
+
+    uint64_t index(uint32_t i, uint32_t j) const
+    {
+        return layout.index(i, j);
+    }
+
+    uint32_t row_of(uint64_t idx) const { return layout.row(idx); }
+    uint32_t col_of(uint64_t idx) const { return layout.col(idx); }
+
+    entity_type_t type(uint64_t idx) const { return cells.type(idx); }
+    int32_t energy(uint64_t idx) const { return cells.energy(idx); }
+    int32_t age(uint64_t idx) const
+    {
+        return cells.type(idx) == plant ? plant_age(idx) : cells.age(idx);
+    }
+    entity_t entity(uint64_t idx) const
+    {
+        entity_t e = cells.entity(idx);
+        if (e.type == plant)
+            e.age = plant_age(idx);
+        return e;
+    }
+    int32_t plant_age(uint64_t idx) const
+    {
+        return plant_ages.age(row_of(idx), col_of(idx));
+    }
+
+    void set_type(uint64_t idx, entity_type_t type)
+    {
+        move_board_bit(idx, cells.type(idx), type);
+        cells.set_type(idx, type);
+        note_type_change(idx, type);
+    }
+    void set_energy(uint64_t idx, int32_t energy) { cells.set_energy(idx, energy); }
+    void set_age(uint64_t idx, int32_t age) { cells.set_age(idx, age); }
+
+    // Empties the cell
+    void clear(uint64_t idx)
+    {
+        move_board_bit(idx, cells.type(idx), empty);
+        cells.clear(idx);
+        note_type_change(idx, empty);
+    }
+
+    // Cell accessors of the entity kernels, the ones sparse_world_t and
+    // fixed_grid_t also offer (see simulate_entity() and age_cells())
+    world_cell_t cell(uint32_t i, uint32_t j) const
+    {
+        return {i, j, index(i, j)};
+    }
+    int32_t energy(const world_cell_t &c) const { return cells.energy(c.idx); }
+    int32_t age(const world_cell_t &c) const { return age(c.idx); }
+    void set_energy(const world_cell_t &c, int32_t energy) { cells.set_energy(c.idx, energy); }
+    bool is_dying(const world_cell_t &c) const { return dying.test(c.i, c.j); }
+    void mark_dying(uint64_t idx) { dying.set(row_of(idx), col_of(idx)); }
+    void mark_processed(const world_cell_t &c) { processed.mark(c.idx); }
+
+    // Puts an entity in the empty cell
+    void place(const world_cell_t &c, entity_type_t type, int32_t energy, int32_t age)
+    {
+        set_type(c.idx, type);
+        cells.set_energy(c.idx, energy);
+        cells.set_age(c.idx, age);
+    }
+
+    void clear(const world_cell_t &c)
+    {
+        clear(c.idx);
+    }
+
+    void move_board_bit(uint64_t idx, entity_type_t from, entity_type_t to)
+    {
+        if (from == to)
+            return;
+        uint32_t i = row_of(idx);
+        uint32_t j = col_of(idx);
+        if (from != empty)
+        {
+            boards[from].unset(i, j);
+            dying.unset(i, j);
+        }
+        if (from == plant)
+            plant_ages.clear(i, j);
+        if (to != empty)
+            boards[to].set(i, j);
+    }
+
+    // Columns 64w .. 64w + 63 of row i holding the type. Rows -1 and num_rows
+    // and words -1 and words_per_row are the halo of the bitboards: nothing in
+    // a closed world, the wrapped cells in a toroidal one.
+    uint64_t type_word(entity_type_t type, int64_t i, int64_t w) const
+    {
+        if (type != empty)
+            return boards[type].word(i, w);
+        uint64_t occupied = boards[plant].word(i, w) | boards[herbivore].word(i, w) | boards[carnivore].word(i, w);
+        return inside.word(i, w) & ~occupied;
+    }
+
+    // Which of the 64 cells of row word (i, w) have a neighbor of the type in
+    // each direction, from five word reads and a few shifts
+    neighbor_words_t neighbor_words(entity_type_t type, uint32_t i, uint32_t w) const
+    {
+        return shifted_neighbors([this, type](int64_t row, int64_t word)
+                                 { return type_word(type, row, word); },
+                                 i, w);
+    }
+
+    // Directions in which (i, j) has a neighbor at all: the ones inside the
+    // grid when it is closed, all four when it wraps around
+    uint32_t existing_neighbors(uint32_t i, uint32_t j) const
+    {
+        return shifted_neighbors([this](int64_t row, int64_t word)
+                                 { return inside.word(row, word); },
+                                 i, j / 64)
+            .mask(j % 64);
+    }
+
+    // Neighbor words of row word (i, w) of the board read by word(row, word)
+    template <typename word_fn_t>
+    static neighbor_words_t shifted_neighbors(word_fn_t word, int64_t i, int64_t w)
+    {
+        uint64_t row_word = word(i, w);
+        neighbor_words_t neighbors;
+        neighbors.dir[NEIGHBOR_DOWN] = word(i + 1, w);
+        neighbors.dir[NEIGHBOR_UP] = word(i - 1, w);
+        neighbors.dir[NEIGHBOR_RIGHT] = (row_word >> 1) | (word(i, w + 1) << 63);
+        neighbors.dir[NEIGHBOR_LEFT] = (row_word << 1) | (word(i, w - 1) >> 63);
+        return neighbors;
+    }
+
+    // Runs fn(i, w, plants) over every row word of the grid, with the plants of
+    // the word, rows split across the workers
+    template <typename fn_t>
+    void for_each_plant_word(fn_t fn)
+    {
+        uint32_t words_per_row = boards[plant].words_per_row;
+        parallel_for(
+            num_rows, [this, words_per_row, &fn](uint64_t begin, uint64_t end)
+            {
+                for (uint64_t i = begin; i < end; i++)
+                {
+                    for (uint32_t w = 0; w < words_per_row; w++)
+                    {
+                        // the padding past the last column may hold halo mirrors
+                        uint64_t plants = boards[plant].word(i, w);
+                        fn((uint32_t)i, w, w == words_per_row - 1 ? plants & last_word_mask : plants);
+                    }
+                } },
+            16);
+    }
+
+    // 4-bit mask (bit d for neighbor_direction_t d) of the neighbors of (i, j)
+    // holding the type
+    uint32_t neighbor_mask(entity_type_t type, uint32_t i, uint32_t j) const
+    {
+        return neighbor_words(type, i, j / 64).mask(j % 64);
+    }
+
+    uint32_t neighbor_mask(entity_type_t type, const world_cell_t &c) const
+    {
+        return neighbor_mask(type, c.i, c.j);
+    }
+
+    // Neighbor of the cell in the direction, which must exist (see
+    // existing_neighbors()). Steps off one side of the grid come back on the
+    // other, which only happens when the world wraps around.
+    world_cell_t neighbor(const world_cell_t &c, uint32_t direction) const
+    {
+        int64_t ni = (int64_t)c.i + NEIGHBOR_ROW_STEPS[direction];
+        int64_t nj = (int64_t)c.j + NEIGHBOR_COL_STEPS[direction];
+        ni += (ni < 0) * (int64_t)num_rows - (ni >= num_rows) * (int64_t)num_rows;
+        nj += (nj < 0) * (int64_t)num_cols - (nj >= num_cols) * (int64_t)num_cols;
+        return cell((uint32_t)ni, (uint32_t)nj);
+    }
+
+    // Cell index of the neighbor of (i, j) in the direction
+    uint64_t neighbor_index(uint32_t i, uint32_t j, uint32_t direction) const
+    {
+        return neighbor({i, j, 0}, direction).idx;
+    }
+
+    void note_type_change(uint64_t idx, entity_type_t type)
+    {
+        if (defer_active)
+            pending_active[current_worker()].push_back(idx);
+        else
+            active.sync(idx, type);
+    }
+
+    // Applies the logged active list updates. The logs only hold cell indices
+    // and each cell is synced to its final type, so the order does not matter.
+    void flush_active()
+    {
+        for (std::vector<uint64_t> &log : pending_active)
+        {
+            for (uint64_t idx : log)
+            {
+                active.sync(idx, cells.type(idx));
+            }
+            log.clear();
+        }
+    }
+
+    void swap_buffers()
+    {
+        std::swap(cells, next_cells);
+    }
+
+    // Updates the active lists and bitboards for a cell written behind their
+    // back; the list the cell is in still tells its previous type
+    void sync_active(uint64_t idx)
+    {
+        move_board_bit(idx, (entity_type_t)active.listed[idx], cells.type(idx));
+        active.sync(idx, cells.type(idx));
+    }
+};